@@ -0,0 +1,271 @@
+#include "audio.hpp"
+
+#include "error.hpp"
+#include "hash.hpp"
+#include "parallel.hpp"
+
+#include <SDL.h>
+
+#ifdef AUDIO_WITH_VORBIS
+#include <vorbis/vorbisenc.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace audio {
+
+namespace {
+
+// Frames converted and encoded at a time
+constexpr int chunkFrames = 4096;
+
+std::string hex(uint64_t value)
+{
+    auto stream = std::ostringstream{};
+    stream << std::hex << std::setw(16) << std::setfill('0') << value;
+    return stream.str();
+}
+
+#ifdef AUDIO_WITH_VORBIS
+// Writes an Ogg Vorbis stream, fed with planar float samples
+class VorbisWriter {
+public:
+    VorbisWriter(std::ostream& output, int channels, int sampleRate, float quality)
+        : _output(output)
+        , _channels(channels)
+    {
+        vorbis_info_init(&_info);
+        if (vorbis_encode_init_vbr(&_info, channels, sampleRate, quality) != 0) {
+            vorbis_info_clear(&_info);
+            throw Error{} << "cannot encode " << channels << " channels at " <<
+                sampleRate << " Hz with quality " << quality;
+        }
+        vorbis_comment_init(&_comment);
+        vorbis_analysis_init(&_dsp, &_info);
+        vorbis_block_init(&_dsp, &_block);
+        // A fixed serial number keeps the output reproducible
+        ogg_stream_init(&_stream, 1);
+
+        auto header = ogg_packet{};
+        auto commentHeader = ogg_packet{};
+        auto codeHeader = ogg_packet{};
+        vorbis_analysis_headerout(
+            &_dsp, &_comment, &header, &commentHeader, &codeHeader);
+        ogg_stream_packetin(&_stream, &header);
+        ogg_stream_packetin(&_stream, &commentHeader);
+        ogg_stream_packetin(&_stream, &codeHeader);
+        auto page = ogg_page{};
+        while (ogg_stream_flush(&_stream, &page) != 0) {
+            writePage(page);
+        }
+    }
+
+    VorbisWriter(const VorbisWriter&) = delete;
+    VorbisWriter& operator=(const VorbisWriter&) = delete;
+
+    ~VorbisWriter()
+    {
+        ogg_stream_clear(&_stream);
+        vorbis_block_clear(&_block);
+        vorbis_dsp_clear(&_dsp);
+        vorbis_comment_clear(&_comment);
+        vorbis_info_clear(&_info);
+    }
+
+    // Encode frames of interleaved samples
+    void write(const float* samples, int frames)
+    {
+        float** buffer = vorbis_analysis_buffer(&_dsp, frames);
+        for (int frame = 0; frame < frames; frame++) {
+            for (int channel = 0; channel < _channels; channel++) {
+                buffer[channel][frame] = samples[frame * _channels + channel];
+            }
+        }
+        vorbis_analysis_wrote(&_dsp, frames);
+        drain();
+    }
+
+    void finish()
+    {
+        vorbis_analysis_wrote(&_dsp, 0);
+        drain();
+    }
+
+private:
+    void drain()
+    {
+        auto packet = ogg_packet{};
+        auto page = ogg_page{};
+        while (vorbis_analysis_blockout(&_dsp, &_block) == 1) {
+            vorbis_analysis(&_block, nullptr);
+            vorbis_bitrate_addblock(&_block);
+            while (vorbis_bitrate_flushpacket(&_dsp, &packet) != 0) {
+                ogg_stream_packetin(&_stream, &packet);
+                while (ogg_stream_pageout(&_stream, &page) != 0) {
+                    writePage(page);
+                }
+            }
+        }
+    }
+
+    void writePage(const ogg_page& page)
+    {
+        _output.write(
+            reinterpret_cast<const char*>(page.header), page.header_len);
+        _output.write(reinterpret_cast<const char*>(page.body), page.body_len);
+    }
+
+    std::ostream& _output;
+    int _channels = 0;
+    vorbis_info _info{};
+    vorbis_comment _comment{};
+    vorbis_dsp_state _dsp{};
+    vorbis_block _block{};
+    ogg_stream_state _stream{};
+};
+#endif
+
+} // namespace
+
+bool canTranscode()
+{
+#ifdef AUDIO_WITH_VORBIS
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool isWav(const fs::path& path)
+{
+    auto input = std::ifstream{path, std::ios::binary};
+    auto header = std::array<char, 12>{};
+    input.read(header.data(), header.size());
+    return input && std::string_view{header.data(), 4} == "RIFF" &&
+        std::string_view{header.data() + 8, 4} == "WAVE";
+}
+
+void transcode(
+    const fs::path& inputPath,
+    const fs::path& outputPath,
+    const TranscodeOptions& options)
+{
+#ifdef AUDIO_WITH_VORBIS
+    auto spec = SDL_AudioSpec{};
+    Uint8* samples = nullptr;
+    Uint32 length = 0;
+    if (!SDL_LoadWAV(inputPath.string().c_str(), &spec, &samples, &length)) {
+        throw Error{} << "cannot load " << inputPath << ": " << SDL_GetError();
+    }
+    const auto wav = std::unique_ptr<Uint8, void(*)(Uint8*)>{
+        samples, SDL_FreeWAV};
+
+    const int channels = std::min<int>(spec.channels, 2);
+    const auto stream = std::unique_ptr<SDL_AudioStream, void(*)(SDL_AudioStream*)>{
+        SDL_NewAudioStream(
+            spec.format, spec.channels, spec.freq,
+            AUDIO_F32SYS, static_cast<Uint8>(channels), options.sampleRate),
+        SDL_FreeAudioStream};
+    if (!stream) {
+        throw Error{} << "cannot convert " << inputPath << ": " <<
+            SDL_GetError();
+    }
+
+    auto output = std::ofstream{};
+    output.exceptions(std::ios::badbit | std::ios::failbit);
+    output.open(outputPath, std::ios::binary | std::ios::trunc);
+    auto writer = VorbisWriter{
+        output, channels, options.sampleRate, options.quality};
+
+    const Uint32 inputFrameSize =
+        SDL_AUDIO_BITSIZE(spec.format) / 8 * spec.channels;
+    const Uint32 inputChunkSize = chunkFrames * inputFrameSize;
+    auto converted = std::vector<float>(size_t{chunkFrames} * channels);
+    const int convertedChunkSize =
+        static_cast<int>(converted.size() * sizeof(float));
+    auto encodeAvailable = [&] {
+        for (;;) {
+            const int received = SDL_AudioStreamGet(
+                stream.get(), converted.data(), convertedChunkSize);
+            if (received < 0) {
+                throw Error{} << "cannot convert " << inputPath << ": " <<
+                    SDL_GetError();
+            }
+            if (received == 0) {
+                return;
+            }
+            writer.write(
+                converted.data(),
+                received / static_cast<int>(sizeof(float)) / channels);
+        }
+    };
+
+    for (Uint32 offset = 0; offset < length; offset += inputChunkSize) {
+        const Uint32 size = std::min(inputChunkSize, length - offset);
+        if (SDL_AudioStreamPut(stream.get(), samples + offset, (int)size) != 0) {
+            throw Error{} << "cannot convert " << inputPath << ": " <<
+                SDL_GetError();
+        }
+        encodeAvailable();
+    }
+    if (SDL_AudioStreamFlush(stream.get()) != 0) {
+        throw Error{} << "cannot convert " << inputPath << ": " <<
+            SDL_GetError();
+    }
+    encodeAvailable();
+    writer.finish();
+#else
+    (void)outputPath;
+    (void)options;
+    throw Error{} << "cannot transcode " << inputPath <<
+        ": built without libvorbisenc";
+#endif
+}
+
+std::vector<fs::path> transcodeToDirectory(
+    const std::vector<fs::path>& paths,
+    const fs::path& directory,
+    const TranscodeOptions& options)
+{
+    fs::create_directories(directory);
+
+    // Options go into the seed, so that a change to them is a cache miss
+    const auto optionBits = std::array<uint64_t, 2>{
+        static_cast<uint64_t>(options.sampleRate),
+        std::bit_cast<uint32_t>(options.quality)};
+    const auto seed = hash64(std::as_bytes(std::span{optionBits}));
+
+    auto results = paths;
+    parallelFor(paths.size(), [&] (size_t i) {
+        if (!isWav(paths.at(i))) {
+            return;
+        }
+        auto& result = results.at(i);
+        result = directory / (hex(hashFile(paths.at(i), seed)) + ".ogg");
+        if (fs::exists(result)) {
+            return;
+        }
+        // Renamed into place once complete, as the same file may be listed
+        // twice, and the directory may be shared
+        auto temporaryPath = result;
+        temporaryPath += ".tmp-" + std::to_string(i);
+        transcode(paths.at(i), temporaryPath, options);
+        fs::rename(temporaryPath, result);
+    });
+    return results;
+}
+
+} // namespace audio
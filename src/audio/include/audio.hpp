@@ -0,0 +1,39 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+namespace audio {
+
+struct TranscodeOptions {
+    // Sample rate the game opens the audio device at (see Config)
+    int sampleRate = 48000;
+    // Vorbis quality, from -0.1 to 1
+    float quality = 0.4f;
+};
+
+// Whether this build can transcode audio, which requires libvorbisenc
+bool canTranscode();
+
+bool isWav(const std::filesystem::path& path);
+
+// Convert a WAV file to Ogg Vorbis, resampled to options.sampleRate and mixed
+// down to at most two channels. Samples are converted and encoded in small
+// chunks, so the input is never held in memory twice.
+void transcode(
+    const std::filesystem::path& inputPath,
+    const std::filesystem::path& outputPath,
+    const TranscodeOptions& options = {});
+
+// Transcode WAV files on one thread per hardware thread, into directory.
+// Returns paths of the results, in order; files in other formats are already
+// compressed, and are returned as they are. Results are named after a hash of
+// the file's contents and the options, and files already transcoded into
+// directory are not transcoded again, so a directory kept between builds
+// serves as a cache.
+std::vector<std::filesystem::path> transcodeToDirectory(
+    const std::vector<std::filesystem::path>& paths,
+    const std::filesystem::path& directory,
+    const TranscodeOptions& options = {});
+
+} // namespace audio
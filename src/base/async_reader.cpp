@@ -0,0 +1,607 @@
+#include "async_reader.hpp"
+
+#include "error.hpp"
+#include "logging.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ASYNC_READER_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Request {
+    uint64_t offset = 0;
+    std::vector<std::byte> buffer;
+    // Bytes read so far, after short reads
+    size_t done = 0;
+    AsyncReader::Callback callback;
+};
+
+void complete(Request& request, std::exception_ptr error)
+{
+    try {
+        request.callback(
+            error ? std::vector<std::byte>{} : std::move(request.buffer), error);
+    } catch (const std::exception& e) {
+        LOG(Error) << "async read callback failed: " << e.what();
+    }
+}
+
+Error endOfFile(const Request& request)
+{
+    return Error{} << "file ends before " << request.buffer.size() <<
+        " bytes at offset " << request.offset;
+}
+
+#ifdef ASYNC_READER_IO_URING
+
+struct Completion {
+    uint64_t userData = 0;
+    int32_t result = 0;
+};
+
+// Bare io_uring, set up with system calls, for reads only. Entries are pushed
+// to the submission ring, and handed to the kernel together by submit().
+// Pushing and submitting must be serialized by the caller; completions are
+// waited for on a single thread.
+class IoUring {
+public:
+    explicit IoUring(uint32_t entries)
+    {
+        auto params = io_uring_params{};
+        _fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (_fd < 0) {
+            throw Error{} << "io_uring_setup failed: " << std::strerror(errno);
+        }
+        try {
+            map(params);
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    ~IoUring()
+    {
+        release();
+    }
+
+    void push(
+        uint8_t opcode,
+        int fd,
+        void* address,
+        uint32_t length,
+        uint64_t offset,
+        uint64_t userData)
+    {
+        const uint32_t tail = *_sqTail;
+        const uint32_t index = tail & *_sqMask;
+        auto& sqe = _sqes[index];
+        sqe = io_uring_sqe{};
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(address);
+        sqe.len = length;
+        sqe.off = offset;
+        sqe.user_data = userData;
+        _sqArray[index] = index;
+        std::atomic_ref{*_sqTail}.store(tail + 1, std::memory_order_release);
+        _unsubmitted++;
+    }
+
+    // Submit the entries pushed since the last call. Entries the kernel does
+    // not take are withdrawn from the ring, and their user data appended to
+    // withdrawn. Returns the error that stopped the kernel from taking them,
+    // or 0.
+    int submit(std::vector<uint64_t>& withdrawn)
+    {
+        if (_unsubmitted == 0) {
+            return 0;
+        }
+
+        long submitted = -1;
+        do {
+            submitted = syscall(
+                __NR_io_uring_enter, _fd, _unsubmitted, 0, 0, nullptr, 0);
+        } while (submitted < 0 && errno == EINTR);
+        const int error = submitted < 0 ? errno : EAGAIN;
+        const uint32_t taken =
+            submitted < 0 ? 0 : static_cast<uint32_t>(submitted);
+
+        // Without a polling thread, the kernel only reads the ring while
+        // entering, so entries it did not take can be withdrawn
+        const uint32_t tail = *_sqTail;
+        const uint32_t first = tail - (_unsubmitted - taken);
+        for (uint32_t i = first; i != tail; i++) {
+            withdrawn.push_back(_sqes[_sqArray[i & *_sqMask]].user_data);
+        }
+        std::atomic_ref{*_sqTail}.store(first, std::memory_order_release);
+        _unsubmitted = 0;
+        return first == tail ? 0 : error;
+    }
+
+    // Wait for at least one completion, and take all that are ready
+    void wait(std::vector<Completion>& completions)
+    {
+        enter(0, 1, IORING_ENTER_GETEVENTS);
+        uint32_t head = *_cqHead;
+        const uint32_t tail =
+            std::atomic_ref{*_cqTail}.load(std::memory_order_acquire);
+        for (; head != tail; head++) {
+            const auto& cqe = _cqes[head & *_cqMask];
+            completions.push_back({.userData = cqe.user_data, .result = cqe.res});
+        }
+        std::atomic_ref{*_cqHead}.store(head, std::memory_order_release);
+    }
+
+private:
+    void map(const io_uring_params& params)
+    {
+        // IORING_OP_READ came with the same release as this feature
+        if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+            throw Error{} << "io_uring without IORING_OP_READ";
+        }
+
+        _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        _cqRingSize =
+            params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) {
+            _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+        }
+        _sqRing = mapRing(_sqRingSize, IORING_OFF_SQ_RING);
+        _cqRing = singleMap ? _sqRing : mapRing(_cqRingSize, IORING_OFF_CQ_RING);
+        _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        _sqes = static_cast<io_uring_sqe*>(mapRing(_sqesSize, IORING_OFF_SQES));
+
+        auto* sq = static_cast<std::byte*>(_sqRing);
+        _sqTail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+        _sqMask = reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+        _sqArray = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+        auto* cq = static_cast<std::byte*>(_cqRing);
+        _cqHead = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+        _cqTail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+        _cqMask = reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+        _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    void* mapRing(size_t size, off_t offset) const
+    {
+        void* address = mmap(
+            nullptr,
+            size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,
+            _fd,
+            offset);
+        if (address == MAP_FAILED) { // NOLINT
+            throw Error{} << "cannot map io_uring: " << std::strerror(errno);
+        }
+        return address;
+    }
+
+    void enter(uint32_t toSubmit, uint32_t minComplete, uint32_t flags) const
+    {
+        while (syscall(
+                __NR_io_uring_enter,
+                _fd,
+                toSubmit,
+                minComplete,
+                flags,
+                nullptr,
+                0) < 0) {
+            if (errno != EINTR) {
+                throw Error{} << "io_uring_enter failed: " << std::strerror(errno);
+            }
+        }
+    }
+
+    void release()
+    {
+        if (_sqes) {
+            munmap(_sqes, _sqesSize);
+        }
+        if (_cqRing && _cqRing != _sqRing) {
+            munmap(_cqRing, _cqRingSize);
+        }
+        if (_sqRing) {
+            munmap(_sqRing, _sqRingSize);
+        }
+        close(_fd);
+    }
+
+    int _fd = -1;
+    void* _sqRing = nullptr;
+    void* _cqRing = nullptr;
+    size_t _sqRingSize = 0;
+    size_t _cqRingSize = 0;
+    size_t _sqesSize = 0;
+    io_uring_sqe* _sqes = nullptr;
+    uint32_t* _sqTail = nullptr;
+    uint32_t* _sqMask = nullptr;
+    uint32_t* _sqArray = nullptr;
+    uint32_t* _cqHead = nullptr;
+    uint32_t* _cqTail = nullptr;
+    uint32_t* _cqMask = nullptr;
+    io_uring_cqe* _cqes = nullptr;
+    uint32_t _unsubmitted = 0;
+};
+
+// Submitted to wake the completion thread when stopping
+constexpr uint64_t wakeUserData = 0;
+
+// The kernel caps a single read at about 2 GiB; longer ranges are read in parts
+constexpr uint32_t maxReadLength = 1u << 30;
+
+#endif
+
+} // namespace
+
+class AsyncReader::Backend {
+public:
+    Backend(const fs::path& path, const AsyncReaderOptions& options)
+        : _path(path)
+        , _options(options)
+    {
+        _options.queueDepth = std::max(_options.queueDepth, 1u);
+        _options.fallbackThreads = std::max(_options.fallbackThreads, 1u);
+        if (!fs::exists(path)) {
+            throw Error{} << "path does not exist: " << path;
+        }
+
+#ifdef ASYNC_READER_IO_URING
+        if (!_options.forceThreads) {
+            try {
+                _ring = std::make_unique<IoUring>(_options.queueDepth);
+                _fd = open(path.c_str(), O_RDONLY | O_CLOEXEC); // NOLINT
+                if (_fd == -1) {
+                    throw Error{} << "cannot open " << path << ": " <<
+                        std::strerror(errno);
+                }
+                _threads.emplace_back([this] { reap(); });
+                return;
+            } catch (const std::exception& e) {
+                LOG(Debug) << "reading " << path << " on threads: " << e.what();
+                _ring.reset();
+            }
+        }
+#endif
+
+        for (uint32_t i = 0; i < _options.fallbackThreads; i++) {
+            _threads.emplace_back([this] { work(); });
+        }
+    }
+
+    Backend(const Backend&) = delete;
+    Backend& operator=(const Backend&) = delete;
+
+    ~Backend()
+    {
+        {
+            auto lock = std::lock_guard{_mutex};
+            _stopping = true;
+#ifdef ASYNC_READER_IO_URING
+            if (_ring) {
+                _ring->push(IORING_OP_NOP, -1, nullptr, 0, 0, wakeUserData);
+                auto withdrawn = std::vector<uint64_t>{};
+                if (const int error = _ring->submit(withdrawn)) {
+                    LOG(Error) << "cannot stop async reads: " <<
+                        std::strerror(error);
+                }
+            }
+#endif
+        }
+        _changed.notify_all();
+        _threads.clear();
+
+#ifdef ASYNC_READER_IO_URING
+        if (_fd != -1) {
+            close(_fd);
+        }
+#endif
+    }
+
+    void read(std::vector<std::unique_ptr<Request>> requests)
+    {
+#ifdef ASYNC_READER_IO_URING
+        if (_ring) {
+            auto failed = std::vector<Finished>{};
+            {
+                auto lock = std::lock_guard{_mutex};
+                for (auto& request : requests) {
+                    _queued.push_back(std::move(request));
+                }
+                failed = startQueued();
+            }
+            completeAll(failed);
+            return;
+        }
+#endif
+        {
+            auto lock = std::lock_guard{_mutex};
+            for (auto& request : requests) {
+                _queued.push_back(std::move(request));
+            }
+        }
+        _changed.notify_all();
+    }
+
+    [[nodiscard]] bool usesIoUring() const
+    {
+#ifdef ASYNC_READER_IO_URING
+        return _ring != nullptr;
+#else
+        return false;
+#endif
+    }
+
+private:
+    struct Finished {
+        std::unique_ptr<Request> request;
+        std::exception_ptr error;
+    };
+
+    static void completeAll(std::vector<Finished>& finished)
+    {
+        for (auto& [request, error] : finished) {
+            complete(*request, error);
+        }
+    }
+
+    // Pool thread: read whole requests with a stream of its own. Queued reads
+    // are finished before stopping.
+    void work()
+    {
+        auto input = std::ifstream{_path, std::ios::binary};
+        for (;;) {
+            auto request = std::unique_ptr<Request>{};
+            {
+                auto lock = std::unique_lock{_mutex};
+                _changed.wait(lock, [this] {
+                    return _stopping || !_queued.empty();
+                });
+                if (_queued.empty()) {
+                    return;
+                }
+                request = std::move(_queued.front());
+                _queued.pop_front();
+            }
+
+            if (!input.is_open()) {
+                complete(*request, std::make_exception_ptr(
+                    Error{} << "cannot open " << _path));
+                continue;
+            }
+            auto error = std::exception_ptr{};
+            input.clear();
+            input.seekg(static_cast<std::streamoff>(request->offset));
+            input.read(
+                reinterpret_cast<char*>(request->buffer.data()),
+                static_cast<std::streamsize>(request->buffer.size()));
+            if (!input || static_cast<size_t>(input.gcount()) !=
+                    request->buffer.size()) {
+                error = std::make_exception_ptr(endOfFile(*request));
+            }
+            complete(*request, error);
+        }
+    }
+
+#ifdef ASYNC_READER_IO_URING
+    // Push the rest of a request to the ring. Called with the mutex held.
+    void push(std::unique_ptr<Request> request)
+    {
+        const auto length = static_cast<uint32_t>(std::min<size_t>(
+            request->buffer.size() - request->done, maxReadLength));
+        auto* address = request->buffer.data() + request->done;
+        const uint64_t offset = request->offset + request->done;
+        _ring->push(
+            IORING_OP_READ,
+            _fd,
+            address,
+            length,
+            offset,
+            reinterpret_cast<uint64_t>(request.release()));
+    }
+
+    // Push queued reads while fewer than queueDepth are in flight, and submit
+    // them together with reads pushed before. Called with the mutex held.
+    // Reads the kernel does not take are returned with the error, to be
+    // completed once the mutex is released.
+    std::vector<Finished> startQueued()
+    {
+        auto failed = std::vector<Finished>{};
+        auto withdrawn = std::vector<uint64_t>{};
+        for (;;) {
+            while (_inFlight < _options.queueDepth && !_queued.empty()) {
+                _inFlight++;
+                push(std::move(_queued.front()));
+                _queued.pop_front();
+            }
+
+            withdrawn.clear();
+            const int error = _ring->submit(withdrawn);
+            if (withdrawn.empty()) {
+                return failed;
+            }
+            for (const uint64_t userData : withdrawn) {
+                auto request = std::unique_ptr<Request>{
+                    reinterpret_cast<Request*>(userData)};
+                _inFlight--;
+                failed.push_back({
+                    .request = std::move(request),
+                    .error = std::make_exception_ptr(
+                        Error{} << "cannot submit read: " <<
+                            std::strerror(error)),
+                });
+            }
+        }
+    }
+
+    // Completion thread: continue short reads, complete finished ones, and
+    // submit queued reads in their place, all at once for the completions
+    // taken together
+    void reap()
+    {
+        auto completions = std::vector<Completion>{};
+        auto finished = std::vector<Finished>{};
+        for (;;) {
+            completions.clear();
+            try {
+                _ring->wait(completions);
+            } catch (const std::exception& e) {
+                LOG(Error) << "async reads stopped: " << e.what();
+                return;
+            }
+
+            finished.clear();
+            {
+                auto lock = std::lock_guard{_mutex};
+                for (const auto& completion : completions) {
+                    if (completion.userData == wakeUserData) {
+                        continue;
+                    }
+                    auto request = std::unique_ptr<Request>{
+                        reinterpret_cast<Request*>(completion.userData)};
+
+                    auto error = std::exception_ptr{};
+                    if (completion.result < 0) {
+                        error = std::make_exception_ptr(Error{} <<
+                            "cannot read " << request->buffer.size() <<
+                            " bytes at offset " << request->offset << ": " <<
+                            std::strerror(-completion.result));
+                    } else if (completion.result == 0) {
+                        error = std::make_exception_ptr(endOfFile(*request));
+                    } else {
+                        request->done += static_cast<size_t>(completion.result);
+                        if (request->done < request->buffer.size()) {
+                            push(std::move(request));
+                            continue;
+                        }
+                    }
+                    _inFlight--;
+                    finished.push_back({
+                        .request = std::move(request),
+                        .error = error,
+                    });
+                }
+
+                auto failed = startQueued();
+                std::ranges::move(failed, std::back_inserter(finished));
+            }
+            completeAll(finished);
+
+            auto lock = std::lock_guard{_mutex};
+            if (_stopping && _inFlight == 0) {
+                return;
+            }
+        }
+    }
+#endif
+
+    fs::path _path;
+    AsyncReaderOptions _options;
+
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::deque<std::unique_ptr<Request>> _queued;
+    bool _stopping = false;
+
+#ifdef ASYNC_READER_IO_URING
+    std::unique_ptr<IoUring> _ring;
+    int _fd = -1;
+    uint32_t _inFlight = 0;
+#endif
+
+    std::vector<std::jthread> _threads;
+};
+
+AsyncReader::AsyncReader(const fs::path& path, const AsyncReaderOptions& options)
+    : _backend(std::make_unique<Backend>(path, options))
+{ }
+
+AsyncReader::~AsyncReader() = default;
+
+void AsyncReader::read(uint64_t offset, size_t size, Callback callback)
+{
+    const auto range = Range{.offset = offset, .size = size};
+    read(std::span{&range, 1}, [&callback] (size_t) {
+        return std::move(callback);
+    });
+}
+
+std::future<std::vector<std::byte>> AsyncReader::read(uint64_t offset, size_t size)
+{
+    const auto range = Range{.offset = offset, .size = size};
+    return std::move(read(std::span{&range, 1}).front());
+}
+
+std::vector<std::future<std::vector<std::byte>>> AsyncReader::read(
+    std::span<const Range> ranges)
+{
+    auto futures = std::vector<std::future<std::vector<std::byte>>>{};
+    futures.reserve(ranges.size());
+    read(ranges, [&futures] (size_t) -> Callback {
+        // std::function needs a copyable callback
+        auto promise = std::make_shared<std::promise<std::vector<std::byte>>>();
+        futures.push_back(promise->get_future());
+        return [promise] (std::vector<std::byte> data, std::exception_ptr error) {
+            if (error) {
+                promise->set_exception(error);
+            } else {
+                promise->set_value(std::move(data));
+            }
+        };
+    });
+    return futures;
+}
+
+void AsyncReader::read(
+    std::span<const Range> ranges,
+    const std::function<Callback(size_t index)>& callbackFor)
+{
+    auto requests = std::vector<std::unique_ptr<Request>>{};
+    for (size_t i = 0; i < ranges.size(); i++) {
+        auto request = std::make_unique<Request>(Request{
+            .offset = ranges[i].offset,
+            .buffer = std::vector<std::byte>(ranges[i].size),
+            .done = 0,
+            .callback = callbackFor(i),
+        });
+        if (ranges[i].size == 0) {
+            complete(*request, nullptr);
+        } else {
+            requests.push_back(std::move(request));
+        }
+    }
+    if (!requests.empty()) {
+        _backend->read(std::move(requests));
+    }
+}
+
+bool AsyncReader::usesIoUring() const
+{
+    return _backend->usesIoUring();
+}
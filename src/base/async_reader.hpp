@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <span>
+#include <vector>
+
+struct AsyncReaderOptions {
+    // Reads in flight at once. Further reads are queued until earlier ones
+    // complete.
+    uint32_t queueDepth = 64;
+    // Threads reading when io_uring is not available
+    uint32_t fallbackThreads = 4;
+    // Read on threads even where io_uring is available
+    bool forceThreads = false;
+};
+
+// Reads ranges of a file in the background, so that a caller can queue many
+// reads at once, and decide when disk I/O happens instead of taking page
+// faults on first touch of a mapping. On Linux, reads go through io_uring
+// where the kernel allows it (5.6 and newer, and not blocked by a seccomp
+// policy). Elsewhere, they are done on a pool of threads. Reads queued by one
+// call are submitted to the kernel together, with a single system call.
+//
+// Completions are delivered on a thread of the reader, in no particular order.
+// Reads the kernel refuses to take as they are queued fail on the calling
+// thread instead.
+// Callbacks should hand the data over rather than do heavy work, as they hold
+// up other completions.
+class AsyncReader {
+public:
+    // Receives the bytes read, or the error that prevented reading them
+    using Callback =
+        std::function<void(std::vector<std::byte> data, std::exception_ptr error)>;
+
+    struct Range {
+        uint64_t offset = 0;
+        size_t size = 0;
+    };
+
+    explicit AsyncReader(
+        const std::filesystem::path& path, const AsyncReaderOptions& options = {});
+    AsyncReader(const AsyncReader&) = delete;
+    AsyncReader& operator=(const AsyncReader&) = delete;
+    // Waits for all reads to complete
+    ~AsyncReader();
+
+    // Read size bytes at offset. A range reaching past the end of the file
+    // fails.
+    void read(uint64_t offset, size_t size, Callback callback);
+    [[nodiscard]] std::future<std::vector<std::byte>> read(
+        uint64_t offset, size_t size);
+    // Read several ranges at once, which is cheaper than reading them one by
+    // one. Futures are in the order of the ranges.
+    [[nodiscard]] std::vector<std::future<std::vector<std::byte>>> read(
+        std::span<const Range> ranges);
+
+    [[nodiscard]] bool usesIoUring() const;
+
+private:
+    class Backend;
+
+    void read(
+        std::span<const Range> ranges,
+        const std::function<Callback(size_t index)>& callbackFor);
+
+    std::unique_ptr<Backend> _backend;
+};
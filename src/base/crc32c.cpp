@@ -0,0 +1,105 @@
+#include "crc32c.hpp"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC32C_X86
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) && defined(__linux__)
+#define CRC32C_ARM
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#if defined(_MSC_VER) || !(defined(CRC32C_X86) || defined(CRC32C_ARM))
+#define CRC32C_TARGET
+#elif defined(CRC32C_X86)
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#else
+#define CRC32C_TARGET __attribute__((target("+crc")))
+#endif
+
+namespace {
+
+constexpr uint32_t polynomial = 0x82f63b78;
+
+constexpr auto table = [] {
+    auto table = std::array<uint32_t, 256>{};
+    for (uint32_t i = 0; i < table.size(); i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ polynomial : crc >> 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}();
+
+uint32_t crc32cSoftware(uint32_t crc, const std::byte* data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ static_cast<uint32_t>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(CRC32C_X86) || defined(CRC32C_ARM)
+
+CRC32C_TARGET uint32_t crc32cHardware(
+    uint32_t crc, const std::byte* data, size_t size)
+{
+    uint64_t crc64 = crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word = 0;
+        std::memcpy(&word, data, sizeof(word));
+#ifdef CRC32C_X86
+        crc64 = _mm_crc32_u64(crc64, word);
+#else
+        crc64 = __crc32cd(static_cast<uint32_t>(crc64), word);
+#endif
+    }
+
+    crc = static_cast<uint32_t>(crc64);
+    for (; size > 0; data++, size--) {
+#ifdef CRC32C_X86
+        crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*data));
+#else
+        crc = __crc32cb(crc, static_cast<uint8_t>(*data));
+#endif
+    }
+    return crc;
+}
+
+bool hardwareSupported()
+{
+#if defined(CRC32C_X86) && defined(_MSC_VER)
+    int info[4] {};
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#elif defined(CRC32C_X86)
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+}
+
+#endif
+
+} // namespace
+
+uint32_t crc32c(std::span<const std::byte> data, uint32_t crc)
+{
+    crc = ~crc;
+#if defined(CRC32C_X86) || defined(CRC32C_ARM)
+    static const bool useHardware = hardwareSupported();
+    if (useHardware) {
+        return ~crc32cHardware(crc, data.data(), data.size());
+    }
+#endif
+    return ~crc32cSoftware(crc, data.data(), data.size());
+}
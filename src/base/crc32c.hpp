@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// CRC-32C (Castagnoli). Uses SSE 4.2 or ARMv8 CRC instructions when the CPU
+// supports them, and a lookup table otherwise. To checksum data in chunks, pass
+// the result for the previous chunks as crc.
+uint32_t crc32c(std::span<const std::byte> data, uint32_t crc = 0);
@@ -0,0 +1,133 @@
+#include "file_watcher.hpp"
+
+#include "error.hpp"
+
+#include <system_error>
+#include <utility>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+fs::path normalized(const fs::path& path)
+{
+    return fs::absolute(path).lexically_normal();
+}
+
+#ifndef __linux__
+int64_t modificationTime(const fs::path& path)
+{
+    auto error = std::error_code{};
+    const auto time = fs::last_write_time(path, error);
+    return error ? 0 : static_cast<int64_t>(time.time_since_epoch().count());
+}
+#endif
+
+} // namespace
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher()
+    : _fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+{
+    if (_fd == -1) {
+        throw Error{} << "inotify_init1 failed: " << std::strerror(errno);
+    }
+}
+
+FileWatcher::~FileWatcher()
+{
+    close(_fd);
+}
+
+void FileWatcher::watch(const std::vector<fs::path>& paths)
+{
+    for (const auto& [descriptor, directory] : _directories) {
+        inotify_rm_watch(_fd, descriptor);
+    }
+    _directories.clear();
+    _paths.clear();
+
+    auto directories = std::set<fs::path>{};
+    for (const auto& path : paths) {
+        const auto& normalizedPath = *_paths.insert(normalized(path)).first;
+        directories.insert(normalizedPath.parent_path());
+    }
+    for (const auto& directory : directories) {
+        const int descriptor = inotify_add_watch(
+            _fd,
+            directory.c_str(),
+            IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (descriptor == -1) {
+            throw Error{} << "cannot watch " << directory << ": " <<
+                std::strerror(errno);
+        }
+        _directories.emplace(descriptor, directory);
+    }
+}
+
+std::set<fs::path> FileWatcher::changes()
+{
+    auto changes = std::set<fs::path>{};
+    alignas(inotify_event) auto buffer = std::array<char, 4096>{};
+    for (;;) {
+        const auto size = read(_fd, buffer.data(), buffer.size());
+        if (size <= 0) {
+            break;
+        }
+        for (ssize_t offset = 0; offset < size; ) {
+            const auto* event =
+                reinterpret_cast<const inotify_event*>(buffer.data() + offset);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+            auto directory = _directories.find(event->wd);
+            if (directory == _directories.end() || event->len == 0) {
+                continue;
+            }
+            auto path = directory->second / event->name;
+            if (_paths.contains(path)) {
+                changes.insert(std::move(path));
+            }
+        }
+    }
+    return changes;
+}
+
+#else
+
+FileWatcher::FileWatcher() = default;
+FileWatcher::~FileWatcher() = default;
+
+void FileWatcher::watch(const std::vector<fs::path>& paths)
+{
+    _paths.clear();
+    _times.clear();
+    for (const auto& path : paths) {
+        const auto& normalizedPath = *_paths.insert(normalized(path)).first;
+        _times[normalizedPath] = modificationTime(normalizedPath);
+    }
+}
+
+std::set<fs::path> FileWatcher::changes()
+{
+    auto changes = std::set<fs::path>{};
+    for (auto& [path, time] : _times) {
+        const auto currentTime = modificationTime(path);
+        if (currentTime != time) {
+            time = currentTime;
+            changes.insert(path);
+        }
+    }
+    return changes;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <vector>
+
+// Reports changes to a set of files, without waiting for them. On Linux, the
+// directories holding the files are watched with inotify, so that files
+// replaced by renaming, as editors save them, are noticed too. Elsewhere,
+// modification times are polled.
+class FileWatcher {
+public:
+    FileWatcher();
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+    ~FileWatcher();
+
+    // Watch these files instead of the ones watched before
+    void watch(const std::vector<std::filesystem::path>& paths);
+
+    // Watched files changed since the last call
+    [[nodiscard]] std::set<std::filesystem::path> changes();
+
+private:
+    std::set<std::filesystem::path> _paths;
+#ifdef __linux__
+    int _fd = -1;
+    std::map<int, std::filesystem::path> _directories;
+#else
+    std::map<std::filesystem::path, int64_t> _times;
+#endif
+};
@@ -4,9 +4,15 @@
 
 #include <concepts>
 #include <fstream>
+#include <string>
 #include <utility>
 
 #ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
 #elif defined(_WIN32)
 #include <ShlObj.h>
 #endif
@@ -82,6 +88,109 @@ fs::path globalConfigPath()
 
 namespace file {
 
+namespace {
+
+#ifdef __linux__
+class Descriptor {
+public:
+    Descriptor(const fs::path& path, int flags)
+        : _fd(open(path.c_str(), flags | O_CLOEXEC, 0644)) // NOLINT
+    {
+        if (_fd == -1) {
+            throw Error{} << "cannot open " << path << ": " <<
+                std::strerror(errno);
+        }
+    }
+    Descriptor(const Descriptor&) = delete;
+    Descriptor& operator=(const Descriptor&) = delete;
+    ~Descriptor() { close(_fd); }
+
+    operator int() const { return _fd; }
+
+private:
+    int _fd = -1;
+};
+#endif
+
+std::string escapeForMake(const fs::path& path)
+{
+    auto escaped = std::string{};
+    for (char c : path.generic_string()) {
+        switch (c) {
+            case ' ': escaped += "\\ "; break;
+            case '#': escaped += "\\#"; break;
+            case '$': escaped += "$$"; break;
+            default: escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// Copy a range of source into target, opened with truncate or not, starting at
+// targetOffset
+void copyInto(
+    const fs::path& source,
+    uint64_t offset,
+    uint64_t size,
+    const fs::path& target,
+    uint64_t targetOffset,
+    bool truncate)
+{
+#ifdef __linux__
+    const auto input = Descriptor{source, O_RDONLY};
+    const auto output =
+        Descriptor{target, O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0)};
+    if (lseek(output, static_cast<off_t>(targetOffset), SEEK_SET) == -1) {
+        throw Error{} << "cannot seek in " << target << ": " <<
+            std::strerror(errno);
+    }
+    auto inputOffset = static_cast<off_t>(offset);
+    bool copyFileRange = true;
+    while (size > 0) {
+        ssize_t copied = -1;
+        if (copyFileRange) {
+            copied = copy_file_range(input, &inputOffset, output, nullptr, size, 0);
+            if (copied == -1 && (errno == EXDEV || errno == ENOSYS ||
+                    errno == EINVAL || errno == EOPNOTSUPP)) {
+                copyFileRange = false;
+                continue;
+            }
+        } else {
+            copied = sendfile(output, input, &inputOffset, size);
+        }
+        if (copied == -1 && errno == EINTR) {
+            continue;
+        }
+        if (copied == -1) {
+            throw Error{} << "cannot copy " << source << " to " << target <<
+                ": " << std::strerror(errno);
+        }
+        if (copied == 0) {
+            throw Error{} << "unexpected end of " << source;
+        }
+        size -= static_cast<uint64_t>(copied);
+    }
+#else
+    auto input = std::ifstream{};
+    input.exceptions(std::ios::badbit | std::ios::failbit);
+    input.open(source, std::ios::binary);
+    input.seekg(static_cast<std::streamoff>(offset));
+    auto data = std::vector<char>(size);
+    input.read(data.data(), static_cast<std::streamsize>(size));
+
+    auto output = std::fstream{};
+    output.exceptions(std::ios::badbit | std::ios::failbit);
+    output.open(
+        target,
+        std::ios::binary | std::ios::out |
+            (truncate ? std::ios::trunc : std::ios::in));
+    output.seekp(static_cast<std::streamoff>(targetOffset));
+    output.write(data.data(), static_cast<std::streamsize>(size));
+#endif
+}
+
+} // namespace
+
 std::vector<std::byte> read(const fs::path& path)
 {
     if (!fs::exists(path)) {
@@ -97,13 +206,51 @@ std::vector<std::byte> read(const fs::path& path)
     return data;
 }
 
+void readChunks(
+    const fs::path& path,
+    size_t chunkSize,
+    const std::function<void(std::span<const std::byte>)>& f)
+{
+    if (!fs::exists(path)) {
+        throw Error{} << "file does not exist: " << path;
+    }
+    auto input = std::ifstream{};
+    input.exceptions(std::ios::badbit);
+    input.open(path, std::ios::binary);
+    auto buffer = std::vector<std::byte>(chunkSize);
+    while (input) {
+        input.read(
+            reinterpret_cast<char*>(buffer.data()),
+            static_cast<std::streamsize>(buffer.size()));
+        if (input.gcount() > 0) {
+            f(std::span{buffer}.first(static_cast<size_t>(input.gcount())));
+        }
+    }
+}
+
 void write(const fs::path& path, const std::byte* data, size_t size)
 {
+#ifdef __linux__
+    const auto output = Descriptor{path, O_WRONLY | O_CREAT | O_TRUNC};
+    while (size > 0) {
+        const ssize_t written = ::write(output, data, size);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1) {
+            throw Error{} << "cannot write " << path << ": " <<
+                std::strerror(errno);
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+#else
     auto output = std::ofstream{path, std::ios::binary};
     output.exceptions(std::ios::badbit | std::ios::failbit);
     output.write(
         reinterpret_cast<const char*>(data),
         static_cast<std::streamsize>(size));
+#endif
 }
 
 void write(const fs::path& path, const std::span<const std::byte>& data)
@@ -111,4 +258,38 @@ void write(const fs::path& path, const std::span<const std::byte>& data)
     write(path, data.data(), data.size());
 }
 
+void copyRange(
+    const fs::path& source,
+    uint64_t offset,
+    uint64_t size,
+    const fs::path& target)
+{
+    copyInto(source, offset, size, target, 0, true);
+}
+
+void copyRange(
+    const fs::path& source,
+    uint64_t offset,
+    uint64_t size,
+    const fs::path& target,
+    uint64_t targetOffset)
+{
+    copyInto(source, offset, size, target, targetOffset, false);
+}
+
+void writeDepfile(
+    const fs::path& depfilePath,
+    const fs::path& target,
+    const std::vector<fs::path>& dependencies)
+{
+    auto output = std::ofstream{};
+    output.exceptions(std::ios::badbit | std::ios::failbit);
+    output.open(depfilePath);
+    output << escapeForMake(target) << ":";
+    for (const auto& dependency : dependencies) {
+        output << " \\\n  " << escapeForMake(dependency);
+    }
+    output << "\n";
+}
+
 } // namespace file
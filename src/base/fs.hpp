@@ -1,7 +1,9 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
 #include <span>
 #include <vector>
 
@@ -16,9 +18,37 @@ namespace file {
 
 std::vector<std::byte> read(const std::filesystem::path& path);
 
+// Read a file chunk by chunk, passing each to f, so that it is never held in
+// memory whole. Every chunk but the last has chunkSize bytes.
+void readChunks(
+    const std::filesystem::path& path,
+    size_t chunkSize,
+    const std::function<void(std::span<const std::byte>)>& f);
+
 void write(
     const std::filesystem::path& path, const std::byte* data, size_t size);
 void write(
     const std::filesystem::path& path, const std::span<const std::byte>& data);
 
+// Write size bytes of source, starting at offset, to a new file at target. On
+// Linux the bytes are copied by the kernel, without passing through user space.
+void copyRange(
+    const std::filesystem::path& source,
+    uint64_t offset,
+    uint64_t size,
+    const std::filesystem::path& target);
+// Same, writing into the existing file at target, starting at targetOffset
+void copyRange(
+    const std::filesystem::path& source,
+    uint64_t offset,
+    uint64_t size,
+    const std::filesystem::path& target,
+    uint64_t targetOffset);
+
+// Write a Makefile-style depfile, telling that target depends on dependencies
+void writeDepfile(
+    const std::filesystem::path& depfilePath,
+    const std::filesystem::path& target,
+    const std::vector<std::filesystem::path>& dependencies);
+
 } // namespace file
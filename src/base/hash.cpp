@@ -0,0 +1,129 @@
+#include "hash.hpp"
+
+#include "error.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+constexpr uint64_t prime1 = 0x9e3779b185ebca87ull;
+constexpr uint64_t prime2 = 0xc2b2ae3d27d4eb4full;
+constexpr uint64_t prime3 = 0x165667b19e3779f9ull;
+
+// Little-endian load, so that digests do not depend on the platform. Compilers
+// turn this into a single load on little-endian machines.
+uint64_t load(const std::byte* bytes)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; i++) {
+        value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+    }
+    return value;
+}
+
+uint64_t round(uint64_t lane, uint64_t word)
+{
+    return std::rotl(lane + word * prime2, 31) * prime1;
+}
+
+uint64_t avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+} // namespace
+
+Hasher::Hasher(uint64_t seed)
+    : _lanes{seed + prime1 + prime2, seed + prime2, seed, seed - prime1}
+    , _seed(seed)
+{ }
+
+void Hasher::update(std::span<const std::byte> data)
+{
+    _length += data.size();
+
+    if (_bufferSize > 0) {
+        const size_t count = std::min(data.size(), _buffer.size() - _bufferSize);
+        std::memcpy(_buffer.data() + _bufferSize, data.data(), count);
+        _bufferSize += count;
+        data = data.subspan(count);
+        if (_bufferSize < _buffer.size()) {
+            return;
+        }
+        consumeStripe(_buffer.data());
+        _bufferSize = 0;
+    }
+
+    while (data.size() >= _buffer.size()) {
+        consumeStripe(data.data());
+        data = data.subspan(_buffer.size());
+    }
+
+    std::memcpy(_buffer.data(), data.data(), data.size());
+    _bufferSize = data.size();
+}
+
+uint64_t Hasher::digest() const
+{
+    uint64_t h = _length >= _buffer.size() ?
+        std::rotl(_lanes[0], 1) + std::rotl(_lanes[1], 7) +
+            std::rotl(_lanes[2], 12) + std::rotl(_lanes[3], 18) :
+        _seed + prime3;
+    h += _length;
+
+    size_t i = 0;
+    for (; i + 8 <= _bufferSize; i += 8) {
+        h = std::rotl(h ^ round(0, load(_buffer.data() + i)), 27) * prime1 +
+            prime3;
+    }
+    for (; i < _bufferSize; i++) {
+        h ^= static_cast<uint64_t>(_buffer[i]) * prime3;
+        h = std::rotl(h, 11) * prime1;
+    }
+
+    return avalanche(h);
+}
+
+void Hasher::consumeStripe(const std::byte* stripe)
+{
+    for (size_t lane = 0; lane < _lanes.size(); lane++) {
+        _lanes[lane] = round(_lanes[lane], load(stripe + 8 * lane));
+    }
+}
+
+uint64_t hash64(std::span<const std::byte> data, uint64_t seed)
+{
+    auto hasher = Hasher{seed};
+    hasher.update(data);
+    return hasher.digest();
+}
+
+uint64_t hashFile(const std::filesystem::path& path, uint64_t seed)
+{
+    constexpr size_t chunkSize = 4 * 1024 * 1024;
+
+    auto input = std::ifstream{};
+    input.exceptions(std::ios::badbit);
+    input.open(path, std::ios::binary);
+    if (!input) {
+        throw Error{} << "cannot open " << path;
+    }
+
+    auto hasher = Hasher{seed};
+    auto buffer = std::vector<char>(chunkSize);
+    while (input) {
+        input.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        hasher.update(std::as_bytes(
+            std::span{buffer}.first(static_cast<size_t>(input.gcount()))));
+    }
+    return hasher.digest();
+}
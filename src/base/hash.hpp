@@ -0,0 +1,32 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+// Fast non-cryptographic 64-bit hash for content addressing. Data may be fed
+// in chunks of any size, the digest only depends on the concatenated bytes.
+class Hasher {
+public:
+    explicit Hasher(uint64_t seed = 0);
+
+    void update(std::span<const std::byte> data);
+    [[nodiscard]] uint64_t digest() const;
+
+private:
+    void consumeStripe(const std::byte* stripe);
+
+    std::array<uint64_t, 4> _lanes {};
+    std::array<std::byte, 32> _buffer {};
+    size_t _bufferSize = 0;
+    uint64_t _length = 0;
+    uint64_t _seed = 0;
+};
+
+uint64_t hash64(std::span<const std::byte> data, uint64_t seed = 0);
+
+// Hash of a file's contents, read in chunks so that it is never held in memory
+// whole. Equal to hash64 of the contents.
+uint64_t hashFile(const std::filesystem::path& path, uint64_t seed = 0);
@@ -0,0 +1,229 @@
+#include "logging.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+
+namespace logging {
+
+namespace {
+
+Level levelFromEnvironment()
+{
+    static const std::map<std::string, Level> levels {
+        {"debug", Level::Debug},
+        {"error", Level::Error},
+        {"info", Level::Info},
+        {"off", Level::Off},
+        {"trace", Level::Trace},
+        {"warning", Level::Warning},
+    };
+
+    if (const char* value = std::getenv("DINNER_LOG_LEVEL")) {
+        if (auto it = levels.find(value); it != levels.end()) {
+            return it->second;
+        }
+    }
+    return Level::Info;
+}
+
+// Bounded lock-free queue for many producers and a single consumer. Each slot
+// carries a sequence number, telling whether it is free for the producer that
+// claimed its position, or filled for the consumer.
+class Queue {
+public:
+    Queue()
+        : _slots(std::make_unique<Slot[]>(capacity))
+    {
+        for (size_t i = 0; i < capacity; i++) {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(Level level, std::string&& message)
+    {
+        auto position = _head.load(std::memory_order_relaxed);
+        for (;;) {
+            auto& slot = _slots[position % capacity];
+            auto sequence = slot.sequence.load(std::memory_order_acquire);
+            auto difference =
+                static_cast<intptr_t>(sequence) -
+                static_cast<intptr_t>(position);
+            if (difference == 0) {
+                if (_head.compare_exchange_weak(
+                        position, position + 1, std::memory_order_relaxed)) {
+                    slot.level = level;
+                    slot.message = std::move(message);
+                    slot.sequence.store(
+                        position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = _head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(Level& level, std::string& message)
+    {
+        auto& slot = _slots[_tail % capacity];
+        if (slot.sequence.load(std::memory_order_acquire) != _tail + 1) {
+            return false;
+        }
+        level = slot.level;
+        message = std::move(slot.message);
+        slot.sequence.store(_tail + capacity, std::memory_order_release);
+        _tail++;
+        return true;
+    }
+
+private:
+    static constexpr size_t capacity = 8192;
+
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Level level = Level::Info;
+        std::string message;
+    };
+
+    std::unique_ptr<Slot[]> _slots;
+    alignas(64) std::atomic<size_t> _head = 0;
+    alignas(64) size_t _tail = 0;
+};
+
+// Messages are dropped, and counted, if the queue is full: logging never
+// blocks the thread that logs.
+class Logger {
+public:
+    Logger()
+        : _thread([this] { run(); })
+    { }
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    ~Logger()
+    {
+        _stopping.store(true, std::memory_order_release);
+        wake();
+        _thread.join();
+    }
+
+    void submit(Level level, std::string&& message)
+    {
+        if (_queue.push(level, std::move(message))) {
+            _pushed.fetch_add(1, std::memory_order_release);
+            wake();
+        } else {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void flush()
+    {
+        const auto target = _pushed.load(std::memory_order_acquire);
+        for (auto written = _written.load(std::memory_order_acquire);
+                written < target;
+                written = _written.load(std::memory_order_acquire)) {
+            _written.wait(written, std::memory_order_acquire);
+        }
+    }
+
+private:
+    void wake()
+    {
+        _wakeups.fetch_add(1, std::memory_order_release);
+        _wakeups.notify_one();
+    }
+
+    void run()
+    {
+        auto wakeups = _wakeups.load(std::memory_order_acquire);
+        for (;;) {
+            drain();
+            if (_stopping.load(std::memory_order_acquire)) {
+                drain();
+                return;
+            }
+            _wakeups.wait(wakeups, std::memory_order_acquire);
+            wakeups = _wakeups.load(std::memory_order_acquire);
+        }
+    }
+
+    void drain()
+    {
+        auto level = Level::Info;
+        auto message = std::string{};
+        size_t count = 0;
+        while (_queue.pop(level, message)) {
+            std::clog << "[" << level << "] " << message << "\n";
+            count++;
+        }
+        if (auto dropped = _dropped.exchange(0, std::memory_order_relaxed)) {
+            std::clog << "[" << Level::Warning << "] " << dropped <<
+                " log messages dropped\n";
+        }
+        if (count > 0) {
+            std::clog.flush();
+            _written.fetch_add(count, std::memory_order_release);
+            _written.notify_all();
+        }
+    }
+
+    Queue _queue;
+    std::atomic<size_t> _pushed = 0;
+    std::atomic<size_t> _written = 0;
+    std::atomic<size_t> _dropped = 0;
+    std::atomic<size_t> _wakeups = 0;
+    std::atomic<bool> _stopping = false;
+    std::thread _thread;
+};
+
+Logger& logger()
+{
+    static Logger logger;
+    return logger;
+}
+
+} // namespace
+
+namespace internal {
+
+std::atomic<Level> runtimeLevel = levelFromEnvironment();
+
+void submit(Level level, std::string&& message)
+{
+    logger().submit(level, std::move(message));
+}
+
+} // namespace internal
+
+std::ostream& operator<<(std::ostream& output, Level level)
+{
+    switch (level) {
+        case Level::Trace: return output << "trace";
+        case Level::Debug: return output << "debug";
+        case Level::Info: return output << "info";
+        case Level::Warning: return output << "warning";
+        case Level::Error: return output << "error";
+        case Level::Off: return output << "off";
+    }
+    return output << static_cast<int>(level);
+}
+
+void setLevel(Level level)
+{
+    internal::runtimeLevel.store(level, std::memory_order_relaxed);
+}
+
+void flush()
+{
+    logger().flush();
+}
+
+} // namespace logging
@@ -1,10 +1,93 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <ostream>
+#include <sstream>
+#include <string>
 #include <utility>
 #include <vector>
 
+// Messages are logged with the LOG macro:
+//
+//     LOG(Info) << "loading booka story from " << path;
+//
+// A message below the compile-time level (LOG_LEVEL, Trace in debug builds and
+// Info otherwise) is compiled out. A message below the runtime level (Info by
+// default, or the DINNER_LOG_LEVEL environment variable) is skipped before any
+// of its arguments are evaluated. Enabled messages are formatted by the calling
+// thread, and written to stderr by a background thread.
+#define LOG(LEVEL) \
+    if (!::logging::enabled(::logging::Level::LEVEL)) {} \
+    else ::logging::Record{::logging::Level::LEVEL}
+
+#ifndef LOG_LEVEL
+#ifdef NDEBUG
+#define LOG_LEVEL Info
+#else
+#define LOG_LEVEL Trace
+#endif
+#endif
+
+namespace logging {
+
+enum class Level {
+    Trace,
+    Debug,
+    Info,
+    Warning,
+    Error,
+    Off,
+};
+
+std::ostream& operator<<(std::ostream& output, Level level);
+
+inline constexpr Level compiledLevel = Level::LOG_LEVEL;
+
+namespace internal {
+
+extern std::atomic<Level> runtimeLevel;
+
+void submit(Level level, std::string&& message);
+
+} // namespace internal
+
+inline bool enabled(Level level)
+{
+    return level >= compiledLevel &&
+        level >= internal::runtimeLevel.load(std::memory_order_relaxed);
+}
+
+void setLevel(Level level);
+
+// Wait until all messages logged so far are written
+void flush();
+
+class Record {
+public:
+    explicit Record(Level level) : _level(level) {}
+    Record(const Record&) = delete;
+    Record& operator=(const Record&) = delete;
+
+    ~Record()
+    {
+        internal::submit(_level, std::move(_stream).str());
+    }
+
+    template <class T>
+    Record& operator<<(T&& value)
+    {
+        _stream << std::forward<T>(value);
+        return *this;
+    }
+
+private:
+    Level _level;
+    std::ostringstream _stream;
+};
+
+} // namespace logging
+
 class Size {
 public:
     Size(size_t value) : _value(value) {}
@@ -2,6 +2,9 @@
 
 #include "error.hpp"
 
+#include <algorithm>
+#include <cstdint>
+
 #ifdef __linux
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -11,7 +14,38 @@
 
 namespace fs = std::filesystem;
 
-MemoryMappedFile::MemoryMappedFile(const fs::path& path)
+namespace {
+
+size_t pageSize()
+{
+#ifdef __linux__
+    static const auto size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#elif defined(_WIN32)
+    static const auto size = [] {
+        auto info = SYSTEM_INFO{};
+        GetSystemInfo(&info);
+        return static_cast<size_t>(info.dwPageSize);
+    }();
+#else
+    static const auto size = size_t{4096};
+#endif
+    return size;
+}
+
+// Fault the pages in by reading a byte of each
+void touch(std::span<const std::byte> pages)
+{
+    auto sum = std::byte{0};
+    for (size_t offset = 0; offset < pages.size(); offset += pageSize()) {
+        sum ^= *static_cast<const volatile std::byte*>(pages.data() + offset);
+    }
+    [[maybe_unused]] volatile auto result = sum;
+}
+
+} // namespace
+
+MemoryMappedFile::MemoryMappedFile(
+    const fs::path& path, [[maybe_unused]] const MapOptions& options)
 {
     if (!fs::exists(path)) {
         throw Error{} << "path does not exist: " << path;
@@ -28,9 +62,22 @@ MemoryMappedFile::MemoryMappedFile(const fs::path& path)
         fileSize = sb.st_size;
     }
 
-    void* address = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, _fd, 0);
+    const int flags = MAP_PRIVATE | (options.populate ? MAP_POPULATE : 0);
+    void* address = mmap(nullptr, fileSize, PROT_READ, flags, _fd, 0);
     check(address != MAP_FAILED); // NOLINT
 
+#ifdef MADV_HUGEPAGE
+    // Fails on kernels without huge pages for files, which is fine for a hint
+    if (options.hugePages) {
+        madvise(address, fileSize, MADV_HUGEPAGE);
+    }
+#endif
+    if (options.access == Access::Sequential) {
+        check(madvise(address, fileSize, MADV_SEQUENTIAL) == 0);
+    } else if (options.access == Access::Random) {
+        check(madvise(address, fileSize, MADV_RANDOM) == 0);
+    }
+
     _span = {static_cast<std::byte*>(address), static_cast<size_t>(fileSize)};
 #elif defined(_WIN32)
     _fileHandle = CreateFile(
@@ -61,6 +108,9 @@ MemoryMappedFile::MemoryMappedFile(const fs::path& path)
     }
 
     _span = {static_cast<std::byte*>(address), static_cast<size_t>(fileSize.QuadPart)};
+    if (options.populate) {
+        prefetch(_span);
+    }
 #endif
 }
 
@@ -92,3 +142,68 @@ std::span<const std::byte> MemoryMappedFile::span() const
 {
     return _span;
 }
+
+void MemoryMappedFile::prefetch(std::span<const std::byte> data) const
+{
+    const auto range = pages(data);
+    if (range.empty()) {
+        return;
+    }
+#if defined(__linux__) && defined(MADV_POPULATE_READ)
+    // Since Linux 5.14; fall back to touching pages on older kernels
+    if (madvise(range.data(), range.size(), MADV_POPULATE_READ) == 0) {
+        return;
+    }
+#endif
+    touch(range);
+}
+
+void MemoryMappedFile::willNeed(std::span<const std::byte> data) const
+{
+    const auto range = pages(data);
+    if (range.empty()) {
+        return;
+    }
+#ifdef __linux__
+    check(madvise(range.data(), range.size(), MADV_WILLNEED) == 0);
+#elif defined(_WIN32)
+    auto entry = WIN32_MEMORY_RANGE_ENTRY{
+        .VirtualAddress = range.data(),
+        .NumberOfBytes = range.size(),
+    };
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &entry, 0);
+#endif
+}
+
+void MemoryMappedFile::dontNeed(std::span<const std::byte> data) const
+{
+    const auto range = pages(data);
+    if (range.empty()) {
+        return;
+    }
+#ifdef __linux__
+    check(madvise(range.data(), range.size(), MADV_DONTNEED) == 0);
+#elif defined(_WIN32)
+    // Unlocking pages that are not locked removes them from the working set
+    VirtualUnlock(range.data(), range.size());
+#endif
+}
+
+std::span<std::byte> MemoryMappedFile::pages(
+    std::span<const std::byte> data) const
+{
+    const auto begin = std::max(
+        reinterpret_cast<uintptr_t>(data.data()),
+        reinterpret_cast<uintptr_t>(_span.data()));
+    const auto end = std::min(
+        reinterpret_cast<uintptr_t>(data.data() + data.size()),
+        reinterpret_cast<uintptr_t>(_span.data() + _span.size()));
+    if (begin >= end) {
+        return {};
+    }
+
+    // The mapping starts on a page boundary, so rounding down stays inside it
+    const auto pageBegin = begin & ~(uintptr_t{pageSize()} - 1);
+    return _span.subspan(
+        pageBegin - reinterpret_cast<uintptr_t>(_span.data()), end - pageBegin);
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <span>
 
@@ -8,16 +9,51 @@
 #include <windows.h>
 #endif
 
+// How the mapped file is going to be read, for the kernel to tune readahead
+enum class Access : uint8_t {
+    Normal,
+    // Front to back: read far ahead, and drop pages soon after they are read
+    Sequential,
+    // In no particular order: read only the pages touched
+    Random,
+};
+
+struct MapOptions {
+    // Read the whole file while mapping it, so that first touches do not
+    // fault. For files read entirely, soon after opening.
+    bool populate = false;
+    // Ask for transparent huge pages, where the kernel supports them for
+    // files, to take fewer TLB misses over large files
+    bool hugePages = false;
+    Access access = Access::Normal;
+};
+
+// Hints take any span: only its part inside the mapping is affected, so spans
+// of blobs decompressed elsewhere can be passed as they are. Hints are
+// advisory, and ignored where the platform has no equivalent.
 class MemoryMappedFile {
 public:
-    MemoryMappedFile(const std::filesystem::path& path);
+    MemoryMappedFile(
+        const std::filesystem::path& path, const MapOptions& options = {});
     MemoryMappedFile(const MemoryMappedFile& other) = delete;
     MemoryMappedFile(MemoryMappedFile&& other) noexcept;
     ~MemoryMappedFile();
 
     [[nodiscard]] std::span<const std::byte> span() const;
 
+    // Read the pages of data in now, returning once they are resident. For a
+    // loader thread warming data before it is needed.
+    void prefetch(std::span<const std::byte> data) const;
+    // Start reading the pages of data in the background, and return at once
+    void willNeed(std::span<const std::byte> data) const;
+    // Let the pages of data go; they are read from the file again if touched
+    void dontNeed(std::span<const std::byte> data) const;
+
 private:
+    // Part of data inside the mapping, widened to whole pages
+    [[nodiscard]] std::span<std::byte> pages(
+        std::span<const std::byte> data) const;
+
 #ifdef __linux__
     int _fd = -1;
 #elif defined(_WIN32)
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Call f(i) for every i in [0, count), on up to one thread per hardware thread.
+// After the first exception, no more indices are taken, and the exception is
+// rethrown once all threads finish.
+template <std::invocable<size_t> F>
+void parallelFor(size_t count, F&& f)
+{
+    auto next = std::atomic<size_t>{0};
+    auto errorMutex = std::mutex{};
+    auto error = std::exception_ptr{};
+    auto work = [&] {
+        try {
+            for (size_t i = next++; i < count; i = next++) {
+                f(i);
+            }
+        } catch (...) {
+            next = count;
+            auto lock = std::lock_guard{errorMutex};
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    {
+        const size_t threadCount = std::min<size_t>(
+            std::max(std::thread::hardware_concurrency(), 1u), count);
+        auto threads = std::vector<std::jthread>{};
+        for (size_t i = 1; i < threadCount; i++) {
+            threads.emplace_back(work);
+        }
+        work();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
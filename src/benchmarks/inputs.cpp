@@ -0,0 +1,168 @@
+#include "inputs.hpp"
+
+#include "fs.hpp"
+
+#include "repa.hpp"
+#include "unpacked_booka.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace inputs {
+
+namespace {
+
+constexpr size_t blobSize = 64 * 1024;
+
+const std::vector<std::string> words {
+    "the", "dinner", "is", "served", "and", "nobody", "knows", "who",
+    "invited", "whom", "to", "this", "house", "on", "a", "rainy", "evening",
+};
+
+fs::path workDirectory = fs::temp_directory_path() / "dinner-benchmarks";
+
+const fs::path& directory()
+{
+    fs::create_directories(workDirectory);
+    return workDirectory;
+}
+
+std::vector<std::byte> randomBytes(size_t size, uint64_t seed)
+{
+    auto random = std::mt19937_64{seed};
+    auto bytes = std::vector<std::byte>(size);
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+        auto value = random();
+        auto count = std::min(sizeof(value), size - i);
+        std::memcpy(bytes.data() + i, &value, count);
+    }
+    return bytes;
+}
+
+std::string phrase(std::mt19937_64& random)
+{
+    auto length = 3 + random() % 12;
+    auto result = std::string{};
+    for (size_t i = 0; i < length; i++) {
+        if (i > 0) {
+            result += " ";
+        }
+        result += words.at(random() % words.size());
+    }
+    return result;
+}
+
+} // namespace
+
+void setWorkDirectory(const fs::path& path)
+{
+    workDirectory = path;
+}
+
+std::string name(size_t index)
+{
+    static const std::vector<std::string> prefixes {
+        "characters/", "images/backgrounds/", "images/sprites/", "music/",
+    };
+    return prefixes.at(index % prefixes.size()) + "resource-" +
+        std::to_string(index);
+}
+
+std::vector<std::string> names(size_t totalSize)
+{
+    auto result = std::vector<std::string>{};
+    for (size_t size = 0; size < totalSize || result.empty(); ) {
+        result.push_back(name(result.size()));
+        size += result.back().size();
+    }
+    return result;
+}
+
+std::vector<std::vector<std::byte>> blobs(size_t totalSize)
+{
+    auto result = std::vector<std::vector<std::byte>>{};
+    for (size_t size = 0; size < totalSize || result.empty(); ) {
+        auto next = std::min(blobSize, std::max<size_t>(totalSize - size, 1));
+        result.push_back(randomBytes(next, result.size()));
+        size += next;
+    }
+    return result;
+}
+
+const fs::path& file(size_t size)
+{
+    static std::map<size_t, fs::path> files;
+    if (auto it = files.find(size); it != files.end()) {
+        return it->second;
+    }
+
+    auto path = directory() / ("file-" + std::to_string(size));
+    if (!fs::exists(path) || fs::file_size(path) != size) {
+        file::write(path, randomBytes(size, size));
+    }
+    return files.emplace(size, path).first->second;
+}
+
+const BookaFile& booka(size_t totalSize)
+{
+    static std::map<size_t, BookaFile> bookas;
+    if (auto it = bookas.find(totalSize); it != bookas.end()) {
+        return it->second;
+    }
+
+    auto random = std::mt19937_64{totalSize};
+    auto unpackedBooka = booka::UnpackedBooka{};
+    for (size_t size = 0; size < totalSize || unpackedBooka.actions.empty(); ) {
+        auto text = phrase(random);
+        size += text.size();
+        unpackedBooka.actions.emplace_back(booka::UnpackedShowTextAction{
+            .character = "character " + std::to_string(random() % 16),
+            .text = std::move(text),
+        });
+    }
+
+    auto path = directory() / ("booka-" + std::to_string(totalSize));
+    unpackedBooka.pack(path);
+    return bookas.emplace(
+        totalSize,
+        BookaFile{.path = path, .actionCount = unpackedBooka.actions.size()})
+        .first->second;
+}
+
+const RepaFile& repa(size_t totalSize)
+{
+    static std::map<size_t, RepaFile> repas;
+    if (auto it = repas.find(totalSize); it != repas.end()) {
+        return it->second;
+    }
+
+    auto resourceDirectory =
+        directory() / ("repa-" + std::to_string(totalSize) + "-resources");
+    fs::create_directories(resourceDirectory);
+
+    auto manifest = repa::Manifest{};
+    for (size_t size = 0; size < totalSize || manifest.sources.empty(); ) {
+        auto index = manifest.sources.size();
+        auto next = std::min(blobSize, std::max<size_t>(totalSize - size, 1));
+        auto path = resourceDirectory / std::to_string(index);
+        file::write(path, randomBytes(next, index));
+        manifest.sources.push_back({.name = name(index), .path = path});
+        size += next;
+    }
+
+    auto path = directory() / ("repa-" + std::to_string(totalSize));
+    repa::pack(manifest, resourceDirectory / "resources.hpp", path);
+    return repas.emplace(
+        totalSize,
+        RepaFile{.path = path, .resourceCount = manifest.sources.size()})
+        .first->second;
+}
+
+} // namespace inputs
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Synthetic inputs for benchmarks. Every generator takes the approximate total
+// size of the input in bytes, and produces the same input for the same size.
+// Files are written to the work directory once, and reused by all benchmarks
+// of the same size.
+namespace inputs {
+
+void setWorkDirectory(const std::filesystem::path& path);
+
+// Names sharing long prefixes, like real resource and character names do.
+std::string name(size_t index);
+std::vector<std::string> names(size_t totalSize);
+
+std::vector<std::vector<std::byte>> blobs(size_t totalSize);
+
+const std::filesystem::path& file(size_t size);
+
+// Booka with text actions only, and the number of actions in it.
+struct BookaFile {
+    std::filesystem::path path;
+    size_t actionCount = 0;
+};
+
+const BookaFile& booka(size_t totalSize);
+
+// Repa with resources named name(0), name(1), ...
+struct RepaFile {
+    std::filesystem::path path;
+    size_t resourceCount = 0;
+};
+
+const RepaFile& repa(size_t totalSize);
+
+} // namespace inputs
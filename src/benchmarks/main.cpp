@@ -0,0 +1,329 @@
+#include "inputs.hpp"
+
+#include "async_reader.hpp"
+#include "booka.hpp"
+#include "data.hpp"
+#include "memory_mapped_file.hpp"
+#include "repa.hpp"
+
+#include "arg.hpp"
+#include "error.hpp"
+#include "logging.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <future>
+#include <istream>
+#include <ostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Size in bytes, given on the command line as a number with an optional K, M
+// or G suffix (binary multiples).
+struct ByteSize {
+    size_t value = 0;
+};
+
+std::istream& operator>>(std::istream& input, ByteSize& size)
+{
+    std::string s;
+    input >> s;
+
+    size_t end = 0;
+    auto value = std::stoull(s, &end);
+    auto suffix = std::string{};
+    for (char c : s.substr(end)) {
+        suffix += (char)std::toupper((unsigned char)c);
+    }
+
+    if (suffix.empty() || suffix == "B") {
+        size.value = value;
+    } else if (suffix == "K" || suffix == "KB" || suffix == "KIB") {
+        size.value = value << 10;
+    } else if (suffix == "M" || suffix == "MB" || suffix == "MIB") {
+        size.value = value << 20;
+    } else if (suffix == "G" || suffix == "GB" || suffix == "GIB") {
+        size.value = value << 30;
+    } else {
+        throw Error{} << "unknown size suffix: " << s.substr(end);
+    }
+    return input;
+}
+
+std::ostream& operator<<(std::ostream& output, const ByteSize& size)
+{
+    return output << size.value;
+}
+
+// Indices to access in benchmarks, so that access patterns do not depend on
+// the input size, and are not trivially predictable. Empty for an empty input,
+// which benchmarks skip.
+std::vector<uint32_t> randomIndices(size_t size)
+{
+    constexpr size_t count = 4096;
+    if (size == 0) {
+        return {};
+    }
+
+    auto random = std::mt19937{size};
+    auto distribution = std::uniform_int_distribution<uint32_t>{
+        0, static_cast<uint32_t>(size - 1)};
+    auto indices = std::vector<uint32_t>(count);
+    for (auto& index : indices) {
+        index = distribution(random);
+    }
+    return indices;
+}
+
+void stringsAccess(benchmark::State& state, data::fb::StringsEncoding encoding)
+{
+    auto builder = flatbuffers::FlatBufferBuilder{};
+    builder.Finish(data::pack(
+        builder,
+        inputs::names(static_cast<size_t>(state.range(0))),
+        {.encoding = encoding}));
+    auto strings = data::Strings{
+        flatbuffers::GetRoot<data::fb::Strings>(builder.GetBufferPointer())};
+    auto indices = randomIndices(strings.size());
+    if (indices.empty()) {
+        state.SkipWithError("no strings to access");
+        return;
+    }
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(strings[indices[i]]);
+        i = (i + 1) % indices.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void namedDataStorageIteration(benchmark::State& state)
+{
+    auto size = static_cast<size_t>(state.range(0));
+    auto blobs = inputs::blobs(size);
+
+    auto names = std::vector<std::string>{};
+    for (size_t i = 0; i < blobs.size(); i++) {
+        names.push_back(inputs::name(i));
+    }
+
+    auto namesBuilder = flatbuffers::FlatBufferBuilder{};
+    namesBuilder.Finish(data::pack(namesBuilder, names));
+    auto dataBuilder = flatbuffers::FlatBufferBuilder{};
+    dataBuilder.Finish(data::pack(dataBuilder, blobs));
+    auto storage = data::NamedDataStorage{
+        flatbuffers::GetRoot<data::fb::Strings>(
+            namesBuilder.GetBufferPointer()),
+        flatbuffers::GetRoot<data::fb::BinaryData>(
+            dataBuilder.GetBufferPointer())};
+
+    for (auto _ : state) {
+        size_t total = 0;
+        for (const auto& namedData : storage) {
+            total += namedData.name.size() + namedData.data.size();
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * storage.size());
+    state.SetBytesProcessed(state.iterations() * size);
+}
+
+void bookaActionsIteration(benchmark::State& state)
+{
+    const auto& input = inputs::booka(static_cast<size_t>(state.range(0)));
+    auto booka = booka::Booka{input.path};
+
+    for (auto _ : state) {
+        for (const auto& action : booka.actions()) {
+            benchmark::DoNotOptimize(action);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * input.actionCount);
+}
+
+void bookaSeek(benchmark::State& state)
+{
+    const auto& input = inputs::booka(static_cast<size_t>(state.range(0)));
+    auto booka = booka::Booka{input.path};
+    const auto actions = randomIndices(input.actionCount);
+    if (actions.empty()) {
+        state.SkipWithError("no actions to seek to");
+        return;
+    }
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(booka.stateAt(actions[i]));
+        i = (i + 1) % actions.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void repaNameLookup(benchmark::State& state)
+{
+    const auto& input = inputs::repa(static_cast<size_t>(state.range(0)));
+    auto repa = repa::Repa{input.path};
+
+    auto names = std::vector<std::string>{};
+    for (auto index : randomIndices(input.resourceCount)) {
+        names.push_back(inputs::name(index));
+    }
+    if (names.empty()) {
+        state.SkipWithError("no resources to look up");
+        return;
+    }
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(repa(names[i]));
+        i = (i + 1) % names.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void dataPack(benchmark::State& state)
+{
+    auto size = static_cast<size_t>(state.range(0));
+    auto blobs = inputs::blobs(size);
+
+    for (auto _ : state) {
+        auto builder = flatbuffers::FlatBufferBuilder{};
+        builder.Finish(data::pack(builder, blobs));
+        benchmark::DoNotOptimize(builder.GetBufferPointer());
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+}
+
+void memoryMappedFileOpenClose(benchmark::State& state)
+{
+    const auto& path = inputs::file(static_cast<size_t>(state.range(0)));
+
+    for (auto _ : state) {
+        auto file = MemoryMappedFile{path};
+        benchmark::DoNotOptimize(file.span().data());
+    }
+}
+
+// Open a file and read a byte of every page, faulting each one in, unless the
+// file is populated when mapped
+void memoryMappedFileTouch(benchmark::State& state, bool populate)
+{
+    auto size = static_cast<size_t>(state.range(0));
+    const auto& path = inputs::file(size);
+
+    for (auto _ : state) {
+        auto file = MemoryMappedFile{path, {.populate = populate}};
+        auto sum = std::byte{0};
+        for (size_t offset = 0; offset < file.span().size(); offset += 4096) {
+            sum ^= file.span()[offset];
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+}
+
+// Read a file in 64 KiB ranges, all queued at once
+void asyncReaderRead(benchmark::State& state, bool forceThreads)
+{
+    constexpr size_t rangeSize = 64 * 1024;
+    auto size = static_cast<size_t>(state.range(0));
+    const auto& path = inputs::file(size);
+    auto reader = AsyncReader{path, {.forceThreads = forceThreads}};
+
+    auto ranges = std::vector<AsyncReader::Range>{};
+    for (size_t offset = 0; offset < size; offset += rangeSize) {
+        ranges.push_back({
+            .offset = offset,
+            .size = std::min(rangeSize, size - offset),
+        });
+    }
+    for (auto _ : state) {
+        auto reads = reader.read(ranges);
+        for (auto& read : reads) {
+            benchmark::DoNotOptimize(read.get().data());
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+}
+
+} // namespace
+
+// Runs benchmarks on synthetic inputs of sizes from --min-size to --max-size.
+// Google Benchmark options are accepted too: for instance, use
+// --benchmark_out=results.json to store results for comparison between
+// releases, and --benchmark_filter to run a subset of benchmarks.
+int main(int argc, char* argv[]) try
+{
+    benchmark::Initialize(&argc, argv);
+
+    auto parser = arg::Parser{};
+    auto minSize = parser.option<ByteSize>()
+        .keys("--min-size")
+        .defaultValue(ByteSize{4 << 10})
+        .help("smallest input size, e.g. 4K");
+    auto maxSize = parser.option<ByteSize>()
+        .keys("--max-size")
+        .defaultValue(ByteSize{16 << 20})
+        .help("largest input size, e.g. 2G");
+    auto workDirectory = parser.option<fs::path>()
+        .keys("--work-dir")
+        .defaultValue(fs::temp_directory_path() / "dinner-benchmarks")
+        .help("directory to keep generated input files in");
+    parser.helpKeys("-h", "--help");
+    parser.parse(argc, argv);
+
+    inputs::setWorkDirectory(workDirectory);
+
+    const ByteSize& min = minSize;
+    const ByteSize& max = maxSize;
+    const auto sized = [&min, &max] (benchmark::internal::Benchmark* benchmark) {
+        benchmark->RangeMultiplier(8)->Range(
+            static_cast<int64_t>(min.value), static_cast<int64_t>(max.value));
+    };
+
+    sized(benchmark::RegisterBenchmark(
+        "Strings/plain", stringsAccess, data::fb::StringsEncoding::Plain));
+    sized(benchmark::RegisterBenchmark(
+        "Strings/interned", stringsAccess, data::fb::StringsEncoding::Interned));
+    sized(benchmark::RegisterBenchmark(
+        "Strings/front-coded",
+        stringsAccess,
+        data::fb::StringsEncoding::FrontCoded));
+    sized(benchmark::RegisterBenchmark(
+        "NamedDataStorage/iteration", namedDataStorageIteration));
+    sized(benchmark::RegisterBenchmark(
+        "booka::Actions/iteration", bookaActionsIteration));
+    sized(benchmark::RegisterBenchmark("booka::Booka/seek", bookaSeek));
+    sized(benchmark::RegisterBenchmark("Repa/name-lookup", repaNameLookup));
+    sized(benchmark::RegisterBenchmark("data::pack", dataPack));
+    sized(benchmark::RegisterBenchmark(
+        "MemoryMappedFile/open-close", memoryMappedFileOpenClose));
+    sized(benchmark::RegisterBenchmark(
+        "MemoryMappedFile/touch", memoryMappedFileTouch, false));
+    sized(benchmark::RegisterBenchmark(
+        "MemoryMappedFile/touch-populated", memoryMappedFileTouch, true));
+    sized(benchmark::RegisterBenchmark(
+        "AsyncReader/read", asyncReaderRead, false));
+    sized(benchmark::RegisterBenchmark(
+        "AsyncReader/read-threads", asyncReaderRead, true));
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+} catch (const std::exception& e) {
+    LOG(Error) << e.what();
+    return EXIT_FAILURE;
+}
@@ -1,16 +1,24 @@
 #include "booka.hpp"
 
 #include "error.hpp"
+#include "interpreter.hpp"
 #include "logging.hpp"
 
+#include <algorithm>
 #include <concepts>
-
-#include <iostream>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
 
 namespace booka {
 
+static_assert(std::ranges::random_access_range<Actions>);
+
 Actions::Actions(const fb::Booka* booka)
     : _booka(booka)
+    , _characterNames(_booka->characterNames())
+    , _phrases(_booka->phrases())
 { }
 
 data::IndexIterator<Actions> Actions::begin() const
@@ -25,28 +33,25 @@ data::IndexIterator<Actions> Actions::end() const
 
 Action Actions::operator[](uint32_t index) const
 {
-    std::cout << "getting action " << index << "\n";
+    LOG(Trace) << "getting action " << index;
     const auto* fbAction = _booka->story()->Get(index);
-    std::cout << "got action pointer\n";
     switch (fbAction->type()) {
         case fb::ActionType::Text:
         {
             const fb::ShowTextAction* fbShowTextAction =
                 _booka->showTextActions()->Get(fbAction->index());
-            std::cout << "character index: " <<
+            LOG(Trace) << "character index: " <<
                 fbShowTextAction->characterIndex() << "; phrase index: " <<
-                fbShowTextAction->phraseIndex() << "\n";
+                fbShowTextAction->phraseIndex();
 
-            auto characterNames = data::Strings{_booka->characterNames()};
             auto characterName = std::string_view{};
             if (fbShowTextAction->characterIndex() != uint32_t(-1)) {
                 characterName =
-                    characterNames[fbShowTextAction->characterIndex()];
+                    _characterNames[fbShowTextAction->characterIndex()];
             }
 
-            auto phrases = data::Strings{_booka->phrases()};
             const std::string_view phrase =
-                phrases[fbShowTextAction->phraseIndex()];
+                _phrases[fbShowTextAction->phraseIndex()];
             return ShowTextAction{
                 .character = characterName,
                 .text = phrase,
@@ -58,7 +63,309 @@ Action Actions::operator[](uint32_t index) const
             return PlayMusicAction{.musicIndex = fbAction->index()};
     }
 
-    throw Error{} << "unknown fb::Action type";
+    return UnknownAction{.type = static_cast<uint8_t>(fbAction->type())};
+}
+
+size_t Actions::size() const
+{
+    return _booka->story()->size();
+}
+
+namespace {
+
+std::optional<uint32_t> index(uint32_t value)
+{
+    if (value == uint32_t(-1)) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+size_t blobCount(const data::fb::BinaryData* fbBinaryData)
+{
+    if (const auto* externalOffsets = fbBinaryData->externalOffsets()) {
+        return externalOffsets->size();
+    }
+    return fbBinaryData->offsets()->size();
+}
+
+// Every operand of the story program, and every jump landing on the start of
+// an instruction
+void validateProgram(const fb::Booka* booka, size_t phraseCount)
+{
+    const auto* code = booka->code();
+    const auto* variableNames = booka->variableNames();
+    if (!code) {
+        return;
+    }
+    size_t variableCount = 0;
+    if (variableNames) {
+        data::validate(variableNames);
+        variableCount = data::Strings{variableNames}.size();
+    }
+    const auto actionCount = booka->story()->size();
+
+    auto starts = std::vector<bool>(code->size());
+    auto targets = std::vector<uint32_t>{};
+    auto check = [&] (uint32_t offset, bool valid, std::string_view what) {
+        if (!valid) {
+            throw Error{} << "story program instruction at word " << offset <<
+                " has an invalid " << what;
+        }
+    };
+    auto lastOpcode = fb::Opcode::Show;
+    for (uint32_t offset = 0; offset < code->size(); ) {
+        const auto opcodeWord = code->Get(offset);
+        lastOpcode = static_cast<fb::Opcode>(opcodeWord & 0xff);
+        const auto size = instructionSize(code, offset);
+        check(offset, size <= code->size() - offset, "length");
+        starts.at(offset) = true;
+        switch (lastOpcode) {
+            case fb::Opcode::Show:
+                check(offset, code->Get(offset + 1) < actionCount, "action");
+                break;
+            case fb::Opcode::Jump:
+                targets.push_back(code->Get(offset + 1));
+                break;
+            case fb::Opcode::JumpIf:
+                check(
+                    offset,
+                    (opcodeWord >> 8) <= static_cast<uint32_t>(
+                        fb::Comparison::MAX),
+                    "comparison");
+                check(offset, code->Get(offset + 1) < variableCount, "slot");
+                targets.push_back(code->Get(offset + 3));
+                break;
+            case fb::Opcode::Choice:
+                check(offset, code->Get(offset + 1) > 0, "option count");
+                for (uint32_t i = offset + 2; i < offset + size; i += 2) {
+                    check(offset, code->Get(i) < phraseCount, "phrase");
+                    targets.push_back(code->Get(i + 1));
+                }
+                break;
+            case fb::Opcode::Set:
+            case fb::Opcode::Add:
+                check(offset, code->Get(offset + 1) < variableCount, "slot");
+                break;
+            case fb::Opcode::Finish:
+                break;
+        }
+        offset += size;
+    }
+
+    // Running off the end of the program is never valid either
+    if (lastOpcode != fb::Opcode::Finish && lastOpcode != fb::Opcode::Jump &&
+            lastOpcode != fb::Opcode::Choice) {
+        throw Error{} << "story program runs past its last instruction";
+    }
+    for (const auto target : targets) {
+        if (target >= code->size() || !starts.at(target)) {
+            throw Error{} << "story program jumps to word " << target <<
+                ", which does not start an instruction";
+        }
+    }
+}
+
+// Every index stored in the booka, checked in one pass over each vector
+void validate(const fb::Booka* booka, std::span<const std::byte> file)
+{
+    data::validate(booka->imageNames());
+    data::validate(booka->musicNames());
+    data::validate(booka->characterNames());
+    data::validate(booka->phrases());
+    data::validate(booka->imageData(), file);
+    data::validate(booka->musicData(), file);
+
+    const auto imageCount = blobCount(booka->imageData());
+    const auto musicCount = blobCount(booka->musicData());
+    if (data::Strings{booka->imageNames()}.size() != imageCount ||
+            data::Strings{booka->musicNames()}.size() != musicCount) {
+        throw Error{} << "booka has a different number of names and blobs";
+    }
+    if (const auto* imagePixels = booka->imagePixels();
+            imagePixels && imagePixels->size() != imageCount) {
+        throw Error{} << "booka has " << imageCount << " images but " <<
+            imagePixels->size() << " pixel layouts";
+    }
+
+    const auto characterCount = data::Strings{booka->characterNames()}.size();
+    const auto phraseCount = data::Strings{booka->phrases()}.size();
+    for (const auto* action : *booka->showTextActions()) {
+        if ((action->characterIndex() != uint32_t(-1) &&
+                    action->characterIndex() >= characterCount) ||
+                action->phraseIndex() >= phraseCount) {
+            throw Error{} << "text action refers to character " <<
+                action->characterIndex() << " of " << characterCount <<
+                ", phrase " << action->phraseIndex() << " of " << phraseCount;
+        }
+    }
+
+    const auto showTextActionCount = booka->showTextActions()->size();
+    for (const auto* action : *booka->story()) {
+        size_t count = 0;
+        switch (action->type()) {
+            case fb::ActionType::Image: count = imageCount; break;
+            case fb::ActionType::Music: count = musicCount; break;
+            case fb::ActionType::Text: count = showTextActionCount; break;
+            default: continue;
+        }
+        if (action->index() >= count) {
+            throw Error{} << "action of type " <<
+                static_cast<int>(action->type()) << " refers to entry " <<
+                action->index() << " of " << count;
+        }
+    }
+
+    validateProgram(booka, phraseCount);
+
+    if (const auto* actionOffsets = booka->actionOffsets()) {
+        const auto* code = booka->code();
+        if (!code || actionOffsets->size() != booka->story()->size()) {
+            throw Error{} << "booka has " << booka->story()->size() <<
+                " actions but " << actionOffsets->size() << " action offsets";
+        }
+        // Offsets are checked against the program, which is valid by now
+        for (uint32_t action = 0; action < actionOffsets->size(); action++) {
+            const auto offset = actionOffsets->Get(action);
+            if (offset >= code->size() - 1 ||
+                    static_cast<fb::Opcode>(code->Get(offset) & 0xff) !=
+                        fb::Opcode::Show ||
+                    code->Get(offset + 1) != action) {
+                throw Error{} << "action offset " << offset <<
+                    " does not show action " << action;
+            }
+        }
+    }
+
+    if (const auto* keyframes = booka->keyframes()) {
+        uint32_t previous = 0;
+        for (const auto* keyframe : *keyframes) {
+            auto valid = [] (uint32_t index, size_t count) {
+                return index == uint32_t(-1) || index < count;
+            };
+            if (keyframe->action() < previous ||
+                    keyframe->action() > booka->story()->size() ||
+                    !valid(keyframe->imageIndex(), imageCount) ||
+                    !valid(keyframe->musicIndex(), musicCount) ||
+                    !valid(keyframe->characterIndex(), characterCount)) {
+                throw Error{} << "keyframe at action " << keyframe->action() <<
+                    " is out of order or refers to a missing entry";
+            }
+            previous = keyframe->action();
+        }
+    }
+}
+
+const fb::Booka* load(std::span<const std::byte> file, const LoadOptions& options)
+{
+    const auto* buffer = reinterpret_cast<const uint8_t*>(file.data());
+    if (file.size() < 8 || !fb::BookaBufferHasIdentifier(buffer)) {
+        throw Error{} << "not a booka file: no \"" << fb::BookaIdentifier() <<
+            "\" identifier";
+    }
+
+    if (options.verify) {
+        // The flatbuffer is at the start of the file, and never larger than
+        // flatbuffers can address, even when the blobs after it are
+        auto verifier = flatbuffers::Verifier{
+            buffer,
+            std::min<size_t>(file.size(), FLATBUFFERS_MAX_BUFFER_SIZE - 1)};
+        if (!fb::VerifyBookaBuffer(verifier)) {
+            throw Error{} << "booka file failed verification";
+        }
+    }
+
+    const auto* booka = fb::GetBooka(buffer);
+    if (booka->compatibleVersion() > formatVersion) {
+        throw Error{} << "booka format version " << booka->formatVersion() <<
+            " needs a reader of version " << booka->compatibleVersion() <<
+            " or later; this one is version " << formatVersion;
+    }
+    if (options.verify) {
+        validate(booka, file);
+    }
+    return booka;
+}
+
+} // namespace
+
+Booka::Booka(const std::filesystem::path& path, const LoadOptions& options)
+    : _file(path, options.mapping)
+    , _booka(load(_file.span(), options))
+    , _images(_booka->imageNames(), _booka->imageData(), _file.span())
+    , _music(_booka->musicNames(), _booka->musicData(), _file.span())
+    , _characterNames(_booka->characterNames())
+    , _phrases(_booka->phrases())
+    , _actions(_booka)
+{
+    if (const auto* variableNames = _booka->variableNames()) {
+        _variableNames.emplace(variableNames);
+    }
+}
+
+StoryState Booka::stateAt(uint32_t action) const
+{
+    auto state = StoryState{};
+    uint32_t first = 0;
+    if (const auto* keyframes = _booka->keyframes()) {
+        auto keyframe = std::upper_bound(
+            keyframes->begin(),
+            keyframes->end(),
+            action,
+            [] (uint32_t action, const fb::Keyframe* keyframe) {
+                return action < keyframe->action();
+            });
+        if (keyframe != keyframes->begin()) {
+            keyframe--;
+            first = (*keyframe)->action();
+            state = StoryState{
+                .imageIndex = index((*keyframe)->imageIndex()),
+                .musicIndex = index((*keyframe)->musicIndex()),
+                .characterIndex = index((*keyframe)->characterIndex()),
+            };
+        }
+    }
+
+    const auto end = std::min<uint32_t>(action, _booka->story()->size());
+    for (uint32_t i = first; i < end; i++) {
+        advance(state, i);
+    }
+    return state;
+}
+
+std::vector<uint32_t> Booka::chapters() const
+{
+    auto chapters = std::vector<uint32_t>{};
+    if (const auto* keyframes = _booka->keyframes()) {
+        for (const auto* keyframe : *keyframes) {
+            if (keyframe->chapter()) {
+                chapters.push_back(keyframe->action());
+            }
+        }
+    }
+    return chapters;
+}
+
+void Booka::advance(StoryState& state, uint32_t action) const
+{
+    const auto* fbAction = _booka->story()->Get(action);
+    switch (fbAction->type()) {
+        case fb::ActionType::Image:
+            state.imageIndex = fbAction->index();
+            break;
+        case fb::ActionType::Music:
+            state.musicIndex = fbAction->index();
+            break;
+        case fb::ActionType::Text:
+        {
+            const auto* showTextAction =
+                _booka->showTextActions()->Get(fbAction->index());
+            state.characterIndex = index(showTextAction->characterIndex());
+            break;
+        }
+        default:
+            break;
+    }
 }
 
 } // namespace booka
@@ -8,13 +8,38 @@
 #include <concepts>
 #include <cstddef>
 #include <filesystem>
+#include <optional>
 #include <span>
 #include <string_view>
 #include <utility>
 #include <variant>
+#include <vector>
 
 namespace booka {
 
+// Format version this code writes and reads. Bump it when appending fields or
+// action types; bump compatibleFormatVersion too if older readers can no
+// longer read what is written.
+constexpr uint32_t formatVersion = 4;
+constexpr uint32_t compatibleFormatVersion = 1;
+// Oldest reader version that runs story programs. Bookas with one are written
+// with it as their compatible version, since playing their actions in order
+// would show every branch.
+constexpr uint32_t programFormatVersion = 2;
+
+// Actions between keyframes written by booka encode, so that seeking replays
+// at most this many actions
+constexpr uint32_t defaultKeyframeInterval = 64;
+
+// Image, music and speaker in effect at some point of the story
+struct StoryState {
+    std::optional<uint32_t> imageIndex;
+    std::optional<uint32_t> musicIndex;
+    std::optional<uint32_t> characterIndex;
+
+    bool operator==(const StoryState&) const = default;
+};
+
 struct ShowImageAction {
     uint32_t imageIndex = 0;
 };
@@ -28,10 +53,16 @@ struct ShowTextAction {
     std::string_view text;
 };
 
+// Action of a type added in a later format version, which should be skipped
+struct UnknownAction {
+    uint8_t type = 0;
+};
+
 using Action = std::variant<
     PlayMusicAction,
     ShowImageAction,
-    ShowTextAction>;
+    ShowTextAction,
+    UnknownAction>;
 
 class Actions {
 public:
@@ -43,34 +74,80 @@ public:
     [[nodiscard]] Iterator end() const;
 
     Action operator[](uint32_t index) const;
+    [[nodiscard]] size_t size() const;
 
 private:
-    const fb::Booka* _booka;
+    const fb::Booka* _booka = nullptr;
+    data::Strings _characterNames;
+    data::Strings _phrases;
+};
+
+struct LoadOptions {
+    // Run flatbuffers::Verifier over the file, and check every index and range
+    // in it once, so that nothing read later can point outside the file. Only
+    // files from untrusted sources need it. The identifier and format version
+    // are checked either way.
+    bool verify = false;
+
+    MapOptions mapping;
 };
 
 class Booka {
 public:
-    Booka(const std::filesystem::path& path)
-        : _file(path)
-        , _booka(fb::GetBooka(_file.span().data()))
-        , _images(_booka->imageNames(), _booka->imageData())
-        , _music(_booka->musicNames(), _booka->musicData())
-        , _characterNames(_booka->characterNames())
-        , _actions(_booka)
-    { }
+    Booka(const std::filesystem::path& path, const LoadOptions& options = {});
 
     [[nodiscard]] const data::NamedDataStorage& images() const { return _images; }
     [[nodiscard]] const data::NamedDataStorage& music() const { return _music; }
     [[nodiscard]] const data::Strings& characterNames() const { return _characterNames; }
     [[nodiscard]] const Actions& actions() const { return _actions; }
 
+    // Pixel layout of an image, if images are stored pre-decoded
+    [[nodiscard]] std::optional<data::fb::Pixels> imagePixels(uint32_t index) const
+    {
+        if (const auto* imagePixels = _booka->imagePixels()) {
+            return *imagePixels->Get(index);
+        }
+        return std::nullopt;
+    }
+
+    // State the story is in when reaching an action in script order, before
+    // the action is presented. Starts from the nearest keyframe, and replays
+    // the actions after it.
+    [[nodiscard]] StoryState stateAt(uint32_t action) const;
+
+    // Actions that start chapters, in order
+    [[nodiscard]] std::vector<uint32_t> chapters() const;
+
+    // Story program, if the story has one (see Interpreter), with the phrases
+    // its choices show, and the names of its variables
+    [[nodiscard]] const flatbuffers::Vector<uint32_t>* code() const
+    {
+        return _booka->code();
+    }
+    [[nodiscard]] const data::Strings& phrases() const { return _phrases; }
+    [[nodiscard]] const std::optional<data::Strings>& variableNames() const
+    {
+        return _variableNames;
+    }
+
+    // The whole mapped file. Uncompressed images and music point into it.
+    [[nodiscard]] std::span<const std::byte> buffer() const { return _file.span(); }
+    // For hints on images and music about to be presented, or done with
+    [[nodiscard]] const MemoryMappedFile& file() const { return _file; }
+
 private:
+    friend class Interpreter;
+
+    void advance(StoryState& state, uint32_t action) const;
+
     MemoryMappedFile _file;
     const fb::Booka* _booka = nullptr;
 
     data::NamedDataStorage _images;
     data::NamedDataStorage _music;
     data::Strings _characterNames;
+    data::Strings _phrases;
+    std::optional<data::Strings> _variableNames;
     Actions _actions;
 };
 
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "booka.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace booka {
+
+class Interpreter;
+
+// Options of a choice, read from the story program on demand
+class Choice {
+public:
+    [[nodiscard]] size_t size() const { return _count; }
+    [[nodiscard]] std::string_view operator[](uint32_t index) const;
+
+private:
+    friend class Interpreter;
+
+    Choice(const Interpreter& interpreter, uint32_t first, uint32_t count);
+
+    const Interpreter* _interpreter = nullptr;
+    uint32_t _first = 0;
+    uint32_t _count = 0;
+};
+
+struct Finish {};
+
+// Everything needed to resume a story where it was: for saving, loading and
+// rewinding
+struct Snapshot {
+    uint32_t position = 0;
+    bool choosing = false;
+    StoryState state;
+    std::optional<uint32_t> lastAction;
+    std::vector<int32_t> variables;
+};
+
+// Length in words of the story program instruction at offset, including the
+// opcode word. Throws on an unknown opcode.
+uint32_t instructionSize(const flatbuffers::Vector<uint32_t>* code, uint32_t offset);
+
+using Step = std::variant<Action, Choice, Finish>;
+
+// Runs the story program of a booka straight from the mapped file. Variables
+// live in slots allocated once, so stepping through the story allocates
+// nothing. A booka without a program plays its actions in order.
+class Interpreter {
+public:
+    explicit Interpreter(const Booka& booka);
+
+    // Run up to the next action to present, choice to make, or the end of the
+    // story. Returns the same choice until one of its options is selected.
+    Step step();
+    void select(uint32_t option);
+
+    // State after the last action returned by step, and that action
+    [[nodiscard]] const StoryState& state() const { return _state; }
+    [[nodiscard]] std::optional<uint32_t> lastAction() const { return _lastAction; }
+
+    [[nodiscard]] Snapshot save() const;
+    void restore(const Snapshot& snapshot);
+
+    // Continue the story from an action, with the state it is reached in, in
+    // script order, restored from the nearest keyframe. In a story with a
+    // program, continues at the instruction showing the action, and keeps the
+    // variables; the state may then differ from the one of the path taken.
+    void seek(uint32_t action);
+
+    [[nodiscard]] size_t variableCount() const { return _variables.size(); }
+    [[nodiscard]] int32_t variable(uint32_t slot) const
+    {
+        return _variables.at(slot);
+    }
+    [[nodiscard]] std::string_view variableName(uint32_t slot) const;
+    // Returns false if the story has no such variable
+    bool setVariable(std::string_view name, int32_t value);
+
+private:
+    friend class Choice;
+
+    [[nodiscard]] uint32_t word(uint32_t offset) const;
+
+    const Booka* _booka = nullptr;
+    const flatbuffers::Vector<uint32_t>* _code = nullptr;
+    data::Strings _phrases;
+    std::optional<data::Strings> _variableNames;
+    std::vector<int32_t> _variables;
+    uint32_t _position = 0;
+    bool _choosing = false;
+    StoryState _state;
+    std::optional<uint32_t> _lastAction;
+};
+
+} // namespace booka
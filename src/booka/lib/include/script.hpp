@@ -0,0 +1,42 @@
+#pragma once
+
+#include "unpacked_booka.hpp"
+
+#include <filesystem>
+#include <string_view>
+
+namespace booka {
+
+// Parse a story script:
+//
+//     [фон "name" path/to/image.png]      declares an image
+//     [музыка "name" path/to/music.wav]   declares a music track
+//     (фон: name)                         shows a declared image
+//     (музыка: name)                      plays a declared music track
+//     (метка: name)                       marks a place to jump to
+//     (переход: name)                     jumps to a label
+//     (если: x >= 3, переход: name)       jumps to a label if a variable
+//                                         compares to a number with ==, !=,
+//                                         <, <=, > or >=
+//     (пусть: x = 3)                      sets an integer variable; += and -=
+//                                         add to it and subtract from it
+//     (конец)                             ends the story
+//     * option text -> name               an option of a choice, jumping to a
+//                                         label; options on consecutive lines
+//                                         make up one choice
+//     (Часть 1: title)                    shows the line as narration, and
+//                                         starts a chapter
+//     (anything else)                     shows the line as narration
+//     Character: phrase                   a phrase said by a character
+//     phrase                              continues the previous speaker
+//     (empty line)                        resets the speaker
+//
+// Variables start at zero. Labels may be used before they are defined.
+// Paths are relative to the directory of scriptPath. Errors are reported as
+// "script:line:column: message", with columns counted in code points.
+UnpackedBooka parseScript(
+    std::string_view script, const std::filesystem::path& scriptPath);
+
+UnpackedBooka parseScript(const std::filesystem::path& scriptPath);
+
+} // namespace booka
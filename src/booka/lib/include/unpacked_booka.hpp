@@ -2,7 +2,9 @@
 
 #include "booka.hpp"
 
+#include <cstdint>
 #include <filesystem>
+#include <string>
 #include <vector>
 
 namespace booka {
@@ -14,16 +16,60 @@ struct UnpackedShowImageAction {
 struct UnpackedShowTextAction {
     std::string character;
     std::string text;
+    // Starts a chapter, which gets a keyframe of its own
+    bool chapter = false;
 };
 
 struct UnpackedPlayMusicAction {
     uint32_t musicIndex = 0;
 };
 
+// Control flow, compiled into the story program when packed. Labels and
+// variables are referred to by name, and resolved to code offsets and variable
+// slots then.
+struct UnpackedLabel {
+    std::string name;
+};
+
+struct UnpackedJump {
+    std::string label;
+};
+
+struct UnpackedJumpIf {
+    std::string variable;
+    fb::Comparison comparison = fb::Comparison::Equal;
+    int32_t value = 0;
+    std::string label;
+};
+
+struct UnpackedChoice {
+    struct Option {
+        std::string text;
+        std::string label;
+    };
+
+    std::vector<Option> options;
+};
+
+struct UnpackedSetVariable {
+    std::string variable;
+    int32_t value = 0;
+    // Add value to the variable instead of setting it
+    bool add = false;
+};
+
+struct UnpackedFinish {};
+
 using UnpackedAction = std::variant<
     UnpackedShowImageAction,
     UnpackedShowTextAction,
-    UnpackedPlayMusicAction
+    UnpackedPlayMusicAction,
+    UnpackedLabel,
+    UnpackedJump,
+    UnpackedJumpIf,
+    UnpackedChoice,
+    UnpackedSetVariable,
+    UnpackedFinish
 >;
 
 struct UnpackedNamedData {
@@ -31,14 +77,27 @@ struct UnpackedNamedData {
     std::vector<char> data;
 };
 
+// Images and music are referenced by path, and streamed into the packed booka
+// file without loading them all into memory.
 struct UnpackedBooka {
     std::vector<std::string> imageNames;
-    std::vector<std::vector<std::byte>> imageData;
+    std::vector<std::filesystem::path> imagePaths;
     std::vector<std::string> musicNames;
-    std::vector<std::vector<std::byte>> musicData;
+    std::vector<std::filesystem::path> musicPaths;
+    // Actions and control flow, in script order. A story with no control flow
+    // is packed without a program, and readable by older readers.
     std::vector<UnpackedAction> actions;
+    // Pixel layout of each image, if imagePaths point to images decoded at
+    // pack time (see pixels::decodeToDirectory)
+    std::vector<data::fb::Pixels> imagePixels;
+    // Actions between keyframes, besides those at chapters; 0 for keyframes at
+    // chapters only
+    uint32_t keyframeInterval = defaultKeyframeInterval;
 
-    void pack(const std::filesystem::path& path);
+    data::PackReport pack(
+        const std::filesystem::path& path,
+        const data::BinaryDataPackOptions& blobOptions = {},
+        const data::StringsPackOptions& phraseOptions = {});
 };
 
 } // namespace booka
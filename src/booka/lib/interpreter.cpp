@@ -0,0 +1,228 @@
+#include "interpreter.hpp"
+
+#include "error.hpp"
+
+#include <algorithm>
+
+namespace booka {
+
+namespace {
+
+// Instructions run by one step without presenting anything, before the story
+// is taken to be stuck in a loop
+constexpr uint32_t maxInstructionsPerStep = 1'000'000;
+
+bool compare(fb::Comparison comparison, int32_t lhs, int32_t rhs)
+{
+    switch (comparison) {
+        case fb::Comparison::Equal: return lhs == rhs;
+        case fb::Comparison::NotEqual: return lhs != rhs;
+        case fb::Comparison::Less: return lhs < rhs;
+        case fb::Comparison::LessEqual: return lhs <= rhs;
+        case fb::Comparison::Greater: return lhs > rhs;
+        case fb::Comparison::GreaterEqual: return lhs >= rhs;
+    }
+    throw Error{} << "unknown comparison " << static_cast<int>(comparison);
+}
+
+} // namespace
+
+Choice::Choice(const Interpreter& interpreter, uint32_t first, uint32_t count)
+    : _interpreter(&interpreter)
+    , _first(first)
+    , _count(count)
+{ }
+
+std::string_view Choice::operator[](uint32_t index) const
+{
+    return _interpreter->_phrases[_interpreter->word(_first + 2 * index)];
+}
+
+uint32_t instructionSize(const flatbuffers::Vector<uint32_t>* code, uint32_t offset)
+{
+    switch (static_cast<fb::Opcode>(code->Get(offset) & 0xff)) {
+        case fb::Opcode::Show: return 2;
+        case fb::Opcode::Jump: return 2;
+        case fb::Opcode::JumpIf: return 4;
+        case fb::Opcode::Choice:
+            if (offset + 1 >= code->size()) {
+                return 2;
+            }
+            return 2 + 2 * std::min<uint32_t>(code->Get(offset + 1), code->size());
+        case fb::Opcode::Set: return 3;
+        case fb::Opcode::Add: return 3;
+        case fb::Opcode::Finish: return 1;
+    }
+    throw Error{} << "unknown opcode " << (code->Get(offset) & 0xff) <<
+        " at word " << offset << " of the story program";
+}
+
+Interpreter::Interpreter(const Booka& booka)
+    : _booka(&booka)
+    , _code(booka._booka->code())
+    , _phrases(booka._booka->phrases())
+{
+    if (const auto* variableNames = booka._booka->variableNames()) {
+        _variableNames.emplace(variableNames);
+        _variables.resize(_variableNames->size());
+    }
+}
+
+Step Interpreter::step()
+{
+    if (!_code) {
+        if (_position >= _booka->actions().size()) {
+            return Finish{};
+        }
+        _booka->advance(_state, _position);
+        _lastAction = _position;
+        return _booka->actions()[_position++];
+    }
+
+    for (uint32_t i = 0; i < maxInstructionsPerStep; i++) {
+        const uint32_t opcodeWord = word(_position);
+        switch (static_cast<fb::Opcode>(opcodeWord & 0xff)) {
+            case fb::Opcode::Show:
+            {
+                const uint32_t action = word(_position + 1);
+                _position += 2;
+                _booka->advance(_state, action);
+                _lastAction = action;
+                return _booka->actions()[action];
+            }
+            case fb::Opcode::Jump:
+                _position = word(_position + 1);
+                break;
+            case fb::Opcode::JumpIf:
+            {
+                const auto comparison =
+                    static_cast<fb::Comparison>((opcodeWord >> 8) & 0xff);
+                const auto value = static_cast<int32_t>(word(_position + 2));
+                if (compare(comparison, _variables[word(_position + 1)], value)) {
+                    _position = word(_position + 3);
+                } else {
+                    _position += 4;
+                }
+                break;
+            }
+            case fb::Opcode::Choice:
+                _choosing = true;
+                return Choice{*this, _position + 2, word(_position + 1)};
+            case fb::Opcode::Set:
+                _variables[word(_position + 1)] =
+                    static_cast<int32_t>(word(_position + 2));
+                _position += 3;
+                break;
+            case fb::Opcode::Add:
+                // Wrap around on overflow, rather than invoke undefined
+                // behavior
+                _variables[word(_position + 1)] = static_cast<int32_t>(
+                    static_cast<uint32_t>(_variables[word(_position + 1)]) +
+                    word(_position + 2));
+                _position += 3;
+                break;
+            case fb::Opcode::Finish:
+                return Finish{};
+            default:
+                throw Error{} << "unknown opcode " << (opcodeWord & 0xff) <<
+                    " at word " << _position << " of the story program";
+        }
+    }
+
+    throw Error{} << "story program ran " << maxInstructionsPerStep <<
+        " instructions without presenting anything, at word " << _position;
+}
+
+void Interpreter::select(uint32_t option)
+{
+    if (!_choosing) {
+        throw Error{} << "no choice to select option " << option << " of";
+    }
+    const uint32_t count = word(_position + 1);
+    if (option >= count) {
+        throw Error{} << "option " << option << " selected in a choice of " <<
+            count;
+    }
+    _position = word(_position + 3 + 2 * option);
+    _choosing = false;
+}
+
+Snapshot Interpreter::save() const
+{
+    return Snapshot{
+        .position = _position,
+        .choosing = _choosing,
+        .state = _state,
+        .lastAction = _lastAction,
+        .variables = _variables,
+    };
+}
+
+void Interpreter::restore(const Snapshot& snapshot)
+{
+    if (snapshot.variables.size() != _variables.size()) {
+        throw Error{} << "snapshot has " << snapshot.variables.size() <<
+            " variables, the story has " << _variables.size();
+    }
+    const auto end = _code ? _code->size() : _booka->actions().size();
+    if (snapshot.position > end) {
+        throw Error{} << "snapshot position " << snapshot.position <<
+            " is past the end of the story";
+    }
+    _position = snapshot.position;
+    _choosing = snapshot.choosing;
+    _state = snapshot.state;
+    _lastAction = snapshot.lastAction;
+    std::ranges::copy(snapshot.variables, _variables.begin());
+}
+
+void Interpreter::seek(uint32_t action)
+{
+    action = std::min<uint32_t>(action, _booka->actions().size());
+    const auto* actionOffsets = _booka->_booka->actionOffsets();
+    if (!_code) {
+        _position = action;
+    } else if (actionOffsets && action < actionOffsets->size()) {
+        _position = actionOffsets->Get(action);
+    } else {
+        // Bookas written before action offsets were added
+        auto offset = uint32_t{0};
+        while (offset < _code->size() &&
+                !(static_cast<fb::Opcode>(word(offset) & 0xff) ==
+                    fb::Opcode::Show && word(offset + 1) == action)) {
+            offset += instructionSize(_code, offset);
+        }
+        if (offset >= _code->size()) {
+            throw Error{} << "story program never shows action " << action;
+        }
+        _position = offset;
+    }
+    _choosing = false;
+    _state = _booka->stateAt(action);
+    _lastAction.reset();
+}
+
+std::string_view Interpreter::variableName(uint32_t slot) const
+{
+    return (*_variableNames)[slot];
+}
+
+bool Interpreter::setVariable(std::string_view name, int32_t value)
+{
+    if (!_variableNames) {
+        return false;
+    }
+    const auto slot = _variableNames->find(name);
+    if (!slot) {
+        return false;
+    }
+    _variables.at(*slot) = value;
+    return true;
+}
+
+uint32_t Interpreter::word(uint32_t offset) const
+{
+    return _code->Get(offset);
+}
+
+} // namespace booka
@@ -0,0 +1,444 @@
+#include "script.hpp"
+
+#include "error.hpp"
+#include "fs.hpp"
+
+#include <charconv>
+#include <functional>
+#include <limits>
+#include <map>
+#include <set>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace booka {
+
+namespace {
+
+constexpr std::string_view imageDirective = "фон";
+constexpr std::string_view musicDirective = "музыка";
+constexpr std::string_view labelDirective = "метка";
+constexpr std::string_view jumpDirective = "переход";
+constexpr std::string_view conditionDirective = "если";
+constexpr std::string_view variableDirective = "пусть";
+constexpr std::string_view finishDirective = "конец";
+constexpr std::string_view chapterDirective = "Часть";
+constexpr std::string_view optionArrow = " -> ";
+
+struct ComparisonOperator {
+    std::string_view text;
+    fb::Comparison comparison;
+};
+
+// Two-character operators first, so that "<=" is not taken for "<"
+constexpr ComparisonOperator comparisonOperators[] = {
+    {"==", fb::Comparison::Equal},
+    {"!=", fb::Comparison::NotEqual},
+    {"<=", fb::Comparison::LessEqual},
+    {">=", fb::Comparison::GreaterEqual},
+    {"<", fb::Comparison::Less},
+    {">", fb::Comparison::Greater},
+};
+
+// Single pass over the script. Lines are views into the script text, and
+// nothing is copied until an action is stored.
+class Parser {
+public:
+    using Indices = std::map<std::string, uint32_t, std::less<>>;
+
+    Parser(std::string_view script, const fs::path& scriptPath)
+        : _script(script)
+        , _scriptPath(scriptPath)
+    { }
+
+    UnpackedBooka parse()
+    {
+        for (size_t start = 0; start < _script.size(); ) {
+            auto end = _script.find('\n', start);
+            if (end == std::string_view::npos) {
+                end = _script.size();
+            }
+            _line = _script.substr(start, end - start);
+            if (_line.ends_with('\r')) {
+                _line.remove_suffix(1);
+            }
+            _lineNumber++;
+            parseLine();
+            start = end + 1;
+        }
+        checkLabels();
+        return std::move(_booka);
+    }
+
+private:
+    struct LabelReference {
+        std::string label;
+        size_t lineNumber = 0;
+        size_t column = 0;
+    };
+
+    void parseLine()
+    {
+        const bool continuesChoice = _inChoice;
+        _inChoice = false;
+        if (_line.empty()) {
+            _character = {};
+        } else if (_line.front() == '[') {
+            parseDeclaration();
+        } else if (_line.front() == '(' && _line.back() == ')') {
+            parseCommand();
+        } else if (_line.starts_with("* ")) {
+            parseOption(continuesChoice);
+        } else if (auto colon = _line.find(':');
+                colon != 0 && colon != std::string_view::npos) {
+            _character = _line.substr(0, colon);
+            addText(_character, skipSpaces(_line.substr(colon + 1)));
+        } else {
+            addText(_character, _line);
+        }
+    }
+
+    // [фон "name" path] or [музыка "name" path]
+    void parseDeclaration()
+    {
+        auto rest = _line.substr(1);
+
+        bool isImage = false;
+        if (consume(rest, imageDirective)) {
+            isImage = true;
+        } else if (!consume(rest, musicDirective)) {
+            fail(rest, "unknown directive");
+        }
+        if (!consume(rest, " \"")) {
+            fail(rest, "expected ' \"' after directive name");
+        }
+
+        auto nameEnd = rest.find_first_of("\"]");
+        if (nameEnd == std::string_view::npos || rest[nameEnd] != '"') {
+            fail(rest, "unterminated name");
+        }
+        if (nameEnd == 0) {
+            fail(rest, "empty name");
+        }
+        auto name = rest.substr(0, nameEnd);
+        rest.remove_prefix(nameEnd + 1);
+
+        if (!consume(rest, " ")) {
+            fail(rest, "expected ' ' after name");
+        }
+        auto pathEnd = rest.find(']');
+        if (pathEnd == std::string_view::npos) {
+            fail(rest, "unterminated directive");
+        }
+        if (pathEnd == 0) {
+            fail(rest, "empty path");
+        }
+        if (pathEnd + 1 != rest.size()) {
+            fail(rest.substr(pathEnd + 1), "unexpected text after directive");
+        }
+        auto pathText = rest.substr(0, pathEnd);
+
+        auto path = _scriptPath.parent_path() / fs::path{pathText};
+        if (!fs::exists(path)) {
+            fail(pathText, "file does not exist: " + path.string());
+        }
+
+        auto& indices = isImage ? _imageIndices : _musicIndices;
+        auto& names = isImage ? _booka.imageNames : _booka.musicNames;
+        auto& paths = isImage ? _booka.imagePaths : _booka.musicPaths;
+        auto [it, inserted] =
+            indices.emplace(std::string{name}, (uint32_t)names.size());
+        if (!inserted) {
+            fail(name, "'" + std::string{name} + "' is already declared");
+        }
+        names.emplace_back(name);
+        paths.push_back(std::move(path));
+    }
+
+    // (фон: name), (музыка: name), control flow, or narration in parentheses
+    void parseCommand()
+    {
+        const auto inner = _line.substr(1, _line.size() - 2);
+        if (inner == finishDirective) {
+            _booka.actions.emplace_back(UnpackedFinish{});
+        } else if (auto label = inner;
+                consume(label, labelDirective) && consume(label, ": ")) {
+            checkName(label, "label");
+            if (!_labels.emplace(label).second) {
+                fail(label,
+                    "label '" + std::string{label} + "' is already defined");
+            }
+            _booka.actions.emplace_back(UnpackedLabel{.name = std::string{label}});
+        } else if (auto jump = inner;
+                consume(jump, jumpDirective) && consume(jump, ": ")) {
+            _booka.actions.emplace_back(UnpackedJump{.label = reference(jump)});
+        } else if (auto condition = inner;
+                consume(condition, conditionDirective) &&
+                    consume(condition, ": ")) {
+            parseCondition(condition);
+        } else if (auto assignment = inner;
+                consume(assignment, variableDirective) &&
+                    consume(assignment, ": ")) {
+            parseAssignment(assignment);
+        } else if (auto imageName = inner;
+                consume(imageName, imageDirective) && consume(imageName, ": ")) {
+            _booka.actions.emplace_back(UnpackedShowImageAction{
+                .imageIndex = find(_imageIndices, imageName)});
+        } else if (auto musicName = inner;
+                consume(musicName, musicDirective) && consume(musicName, ": ")) {
+            _booka.actions.emplace_back(UnpackedPlayMusicAction{
+                .musicIndex = find(_musicIndices, musicName)});
+        } else {
+            addText({}, _line, isChapter(inner));
+        }
+    }
+
+    // (Часть 1: title)
+    static bool isChapter(std::string_view text)
+    {
+        if (!consume(text, chapterDirective) || !consume(text, " ")) {
+            return false;
+        }
+        const auto numberEnd = text.find_first_not_of("0123456789");
+        return numberEnd != 0 && numberEnd != std::string_view::npos &&
+            text[numberEnd] == ':';
+    }
+
+    // (если: variable >= value, переход: label)
+    void parseCondition(std::string_view text)
+    {
+        auto jumpStart = text.find(", ");
+        if (jumpStart == std::string_view::npos) {
+            fail(text, "expected ', переход: label' after condition");
+        }
+        auto jump = text.substr(jumpStart + 2);
+        if (!consume(jump, jumpDirective) || !consume(jump, ": ")) {
+            fail(jump, "expected 'переход: label' after condition");
+        }
+        auto condition = text.substr(0, jumpStart);
+
+        auto operatorStart = condition.find_first_of("=!<>");
+        if (operatorStart == std::string_view::npos) {
+            fail(condition, "expected a comparison: ==, !=, <, <=, > or >=");
+        }
+        auto variable = trimmed(condition.substr(0, operatorStart));
+        checkName(variable, "variable");
+        auto rest = condition.substr(operatorStart);
+        for (const auto& [operatorText, comparison] : comparisonOperators) {
+            if (consume(rest, operatorText)) {
+                _booka.actions.emplace_back(UnpackedJumpIf{
+                    .variable = std::string{variable},
+                    .comparison = comparison,
+                    .value = parseNumber(trimmed(rest)),
+                    .label = reference(jump),
+                });
+                return;
+            }
+        }
+        fail(rest, "expected a comparison: ==, !=, <, <=, > or >=");
+    }
+
+    // (пусть: variable = value), (пусть: variable += value), or
+    // (пусть: variable -= value)
+    //
+    // Names may contain '-' and '+', so the operator is found by its '='.
+    void parseAssignment(std::string_view text)
+    {
+        auto operatorStart = text.find('=');
+        if (operatorStart == std::string_view::npos) {
+            fail(text, "expected '=', '+=' or '-='");
+        }
+        if (operatorStart > 0 && (text[operatorStart - 1] == '+' ||
+                text[operatorStart - 1] == '-')) {
+            operatorStart--;
+        }
+        auto variable = trimmed(text.substr(0, operatorStart));
+        checkName(variable, "variable");
+
+        auto rest = text.substr(operatorStart);
+        auto assignment = UnpackedSetVariable{};
+        assignment.variable = std::string{variable};
+        if (consume(rest, "+=")) {
+            assignment.add = true;
+            assignment.value = parseNumber(trimmed(rest));
+        } else if (consume(rest, "-=")) {
+            assignment.add = true;
+            assignment.value = parseNumber(trimmed(rest));
+            if (assignment.value == std::numeric_limits<int32_t>::min()) {
+                fail(rest, "number out of range");
+            }
+            assignment.value = -assignment.value;
+        } else if (consume(rest, "=")) {
+            assignment.value = parseNumber(trimmed(rest));
+        } else {
+            fail(rest, "expected '=', '+=' or '-='");
+        }
+        _booka.actions.emplace_back(std::move(assignment));
+    }
+
+    // * option text -> label
+    //
+    // Options on consecutive lines make up one choice.
+    void parseOption(bool continuesChoice)
+    {
+        auto text = _line.substr(2);
+        auto arrow = text.rfind(optionArrow);
+        if (arrow == std::string_view::npos) {
+            fail(text, "expected ' -> label' after option text");
+        }
+        auto label = trimmed(text.substr(arrow + optionArrow.size()));
+        auto option = UnpackedChoice::Option{
+            .text = std::string{trimmed(text.substr(0, arrow))},
+            .label = reference(label),
+        };
+
+        if (continuesChoice) {
+            std::get<UnpackedChoice>(_booka.actions.back()).options.push_back(
+                std::move(option));
+        } else {
+            _booka.actions.emplace_back(
+                UnpackedChoice{.options = {std::move(option)}});
+        }
+        _inChoice = true;
+    }
+
+    int32_t parseNumber(std::string_view text)
+    {
+        int32_t value = 0;
+        const auto [end, error] =
+            std::from_chars(text.data(), text.data() + text.size(), value);
+        if (error == std::errc::result_out_of_range) {
+            fail(text, "number out of range");
+        }
+        if (error != std::errc{} || end != text.data() + text.size()) {
+            fail(text, "expected an integer");
+        }
+        return value;
+    }
+
+    void checkName(std::string_view name, std::string_view what)
+    {
+        if (name.empty() || name.find_first_of(" \t") != std::string_view::npos) {
+            fail(name, "expected a " + std::string{what} + " name without spaces");
+        }
+    }
+
+    // Labels may be defined after they are referred to, so references are
+    // checked once the whole script is parsed
+    std::string reference(std::string_view label)
+    {
+        checkName(label, "label");
+        _labelReferences.push_back(LabelReference{
+            .label = std::string{label},
+            .lineNumber = _lineNumber,
+            .column = column(label),
+        });
+        return std::string{label};
+    }
+
+    void checkLabels() const
+    {
+        for (const auto& reference : _labelReferences) {
+            if (!_labels.contains(reference.label)) {
+                throw Error{} << _scriptPath.string() << ":" <<
+                    reference.lineNumber << ":" << reference.column <<
+                    ": label '" << reference.label << "' is not defined";
+            }
+        }
+    }
+
+    uint32_t find(const Indices& indices, std::string_view name)
+    {
+        auto it = indices.find(name);
+        if (it == indices.end()) {
+            fail(name, "'" + std::string{name} + "' is not declared");
+        }
+        return it->second;
+    }
+
+    void addText(
+        std::string_view character, std::string_view text, bool chapter = false)
+    {
+        _booka.actions.emplace_back(UnpackedShowTextAction{
+            .character = std::string{character},
+            .text = std::string{text},
+            .chapter = chapter,
+        });
+    }
+
+    static bool consume(std::string_view& text, std::string_view prefix)
+    {
+        if (!text.starts_with(prefix)) {
+            return false;
+        }
+        text.remove_prefix(prefix.size());
+        return true;
+    }
+
+    static std::string_view skipSpaces(std::string_view text)
+    {
+        auto first = text.find_first_not_of(" \t");
+        return first == std::string_view::npos ? "" : text.substr(first);
+    }
+
+    static std::string_view trimmed(std::string_view text)
+    {
+        text = skipSpaces(text);
+        auto last = text.find_last_not_of(" \t");
+        return last == std::string_view::npos ? text : text.substr(0, last + 1);
+    }
+
+    // position is a view into the current line
+    [[nodiscard]] size_t column(std::string_view position) const
+    {
+        auto offset = static_cast<size_t>(position.data() - _line.data());
+        size_t column = 1;
+        for (size_t i = 0; i < offset; i++) {
+            // Count UTF-8 lead bytes, skipping continuation bytes
+            if ((static_cast<unsigned char>(_line[i]) & 0xc0) != 0x80) {
+                column++;
+            }
+        }
+        return column;
+    }
+
+    [[noreturn]] void fail(std::string_view position, const std::string& message)
+    {
+        throw Error{} << _scriptPath.string() << ":" << _lineNumber << ":" <<
+            column(position) << ": " << message;
+    }
+
+    std::string_view _script;
+    fs::path _scriptPath;
+    std::string_view _line;
+    size_t _lineNumber = 0;
+
+    std::string_view _character;
+    Indices _imageIndices;
+    Indices _musicIndices;
+    std::set<std::string, std::less<>> _labels;
+    std::vector<LabelReference> _labelReferences;
+    bool _inChoice = false;
+    UnpackedBooka _booka;
+};
+
+} // namespace
+
+UnpackedBooka parseScript(std::string_view script, const fs::path& scriptPath)
+{
+    return Parser{script, scriptPath}.parse();
+}
+
+UnpackedBooka parseScript(const fs::path& scriptPath)
+{
+    const auto bytes = file::read(scriptPath);
+    return parseScript(
+        {reinterpret_cast<const char*>(bytes.data()), bytes.size()},
+        scriptPath);
+}
+
+} // namespace booka
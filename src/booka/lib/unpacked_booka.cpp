@@ -1,11 +1,12 @@
 #include "unpacked_booka.hpp"
 
-#include "fs.hpp"
+#include "error.hpp"
 #include "overloaded.hpp"
 
 #include <fstream>
 #include <map>
 #include <string>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -13,13 +14,69 @@
 
 namespace booka {
 
-void UnpackedBooka::pack(const std::filesystem::path& path)
+namespace {
+
+void emit(std::vector<uint32_t>& code, fb::Opcode opcode, uint32_t flags = 0)
+{
+    code.push_back(static_cast<uint32_t>(opcode) | flags << 8);
+}
+
+uint32_t slot(
+    std::map<std::string, uint32_t>& slots,
+    std::vector<std::string>& variableNames,
+    const std::string& variable)
+{
+    auto [it, inserted] = slots.emplace(variable, (uint32_t)slots.size());
+    if (inserted) {
+        variableNames.push_back(variable);
+    }
+    return it->second;
+}
+
+} // namespace
+
+data::PackReport UnpackedBooka::pack(
+    const std::filesystem::path& path,
+    const data::BinaryDataPackOptions& blobOptions,
+    const data::StringsPackOptions& phraseOptions)
 {
     std::map<std::string, uint32_t> characters;
     auto phrases = std::vector<std::string>{};
     auto showTextActions = std::vector<fb::ShowTextAction>{};
     auto actions = std::vector<fb::Action>{};
 
+    // Story program: each action is shown by its own instruction, and jump
+    // targets are patched in once all labels are known
+    auto code = std::vector<uint32_t>{};
+    auto actionOffsets = std::vector<uint32_t>{};
+    auto labels = std::map<std::string, uint32_t>{};
+    auto jumps = std::vector<std::pair<size_t, const std::string*>>{};
+    auto slots = std::map<std::string, uint32_t>{};
+    auto variableNames = std::vector<std::string>{};
+    bool hasControlFlow = false;
+
+    // Keyframes hold the state before their action, as reached in script
+    // order
+    auto keyframes = std::vector<fb::Keyframe>{};
+    auto image = uint32_t(-1);
+    auto music = uint32_t(-1);
+    auto character = uint32_t(-1);
+
+    auto show = [&] (fb::ActionType type, uint32_t index, bool chapter = false) {
+        const auto action = (uint32_t)actions.size();
+        if (chapter || (keyframeInterval > 0 && action % keyframeInterval == 0)) {
+            keyframes.emplace_back(action, image, music, character, chapter);
+        }
+        actionOffsets.push_back((uint32_t)code.size());
+        emit(code, fb::Opcode::Show);
+        code.push_back(action);
+        actions.emplace_back(type, index);
+    };
+    auto jumpTo = [&] (const std::string& label) {
+        jumps.emplace_back(code.size(), &label);
+        code.push_back(0);
+    };
+
     for (const auto& action : this->actions) {
         std::visit(Overloaded{
             [&](const booka::UnpackedShowTextAction& showTextAction) {
@@ -31,40 +88,106 @@ void UnpackedBooka::pack(const std::filesystem::path& path)
 
                 const auto phraseIndex = (uint32_t)phrases.size();
                 phrases.push_back(showTextAction.text);
+                show(
+                    fb::ActionType::Text,
+                    (uint32_t)showTextActions.size(),
+                    showTextAction.chapter);
                 showTextActions.emplace_back(characterIndex, phraseIndex);
-                actions.emplace_back(fb::ActionType::Text, phraseIndex);
+                character = characterIndex;
             },
             [&](const booka::UnpackedShowImageAction& showImageAction) {
-                actions.emplace_back(fb::ActionType::Image, showImageAction.imageIndex);
+                show(fb::ActionType::Image, showImageAction.imageIndex);
+                image = showImageAction.imageIndex;
             },
             [&](const booka::UnpackedPlayMusicAction& playMusicAction) {
-                actions.emplace_back(fb::ActionType::Music, playMusicAction.musicIndex);
+                show(fb::ActionType::Music, playMusicAction.musicIndex);
+                music = playMusicAction.musicIndex;
+            },
+            [&](const booka::UnpackedLabel& label) {
+                if (!labels.emplace(label.name, (uint32_t)code.size()).second) {
+                    throw Error{} << "label '" << label.name <<
+                        "' is defined more than once";
+                }
+            },
+            [&](const booka::UnpackedJump& jump) {
+                hasControlFlow = true;
+                emit(code, fb::Opcode::Jump);
+                jumpTo(jump.label);
+            },
+            [&](const booka::UnpackedJumpIf& jumpIf) {
+                hasControlFlow = true;
+                emit(code, fb::Opcode::JumpIf, (uint32_t)jumpIf.comparison);
+                code.push_back(slot(slots, variableNames, jumpIf.variable));
+                code.push_back(static_cast<uint32_t>(jumpIf.value));
+                jumpTo(jumpIf.label);
+            },
+            [&](const booka::UnpackedChoice& choice) {
+                hasControlFlow = true;
+                if (choice.options.empty()) {
+                    throw Error{} << "choice has no options";
+                }
+                emit(code, fb::Opcode::Choice);
+                code.push_back((uint32_t)choice.options.size());
+                for (const auto& option : choice.options) {
+                    code.push_back((uint32_t)phrases.size());
+                    phrases.push_back(option.text);
+                    jumpTo(option.label);
+                }
+            },
+            [&](const booka::UnpackedSetVariable& setVariable) {
+                hasControlFlow = true;
+                emit(code, setVariable.add ? fb::Opcode::Add : fb::Opcode::Set);
+                code.push_back(slot(slots, variableNames, setVariable.variable));
+                code.push_back(static_cast<uint32_t>(setVariable.value));
+            },
+            [&](const booka::UnpackedFinish&) {
+                hasControlFlow = true;
+                emit(code, fb::Opcode::Finish);
             },
         }, action);
     }
+    emit(code, fb::Opcode::Finish);
+
+    for (const auto& [offset, label] : jumps) {
+        auto it = labels.find(*label);
+        if (it == labels.end()) {
+            throw Error{} << "label '" << *label << "' is not defined";
+        }
+        code.at(offset) = it->second;
+    }
 
     auto characterNames = std::vector<std::string>{};
     for (const auto& [characterName, characterIndex] : characters) {
         characterNames.push_back(characterName);
     }
 
-    auto builder = flatbuffers::FlatBufferBuilder{};
-    auto booka = fb::CreateBooka(
-        builder,
-        data::pack(builder, imageNames),
-        data::pack(builder, imageData),
-        data::pack(builder, musicNames),
-        data::pack(builder, musicData),
-        data::pack(builder, characterNames),
-        data::pack(builder, phrases),
-        builder.CreateVectorOfStructs(showTextActions),
-        builder.CreateVectorOfStructs(actions));
-    builder.Finish(booka);
-
-    file::write(
+    return data::packStreaming(
         path,
-        reinterpret_cast<const std::byte*>(builder.GetBufferPointer()),
-        builder.GetSize());
+        {imagePaths, musicPaths},
+        [&] (flatbuffers::FlatBufferBuilder& builder,
+                const std::vector<flatbuffers::Offset<data::fb::BinaryData>>& blobTables) {
+            return fb::CreateBooka(
+                builder,
+                data::pack(builder, imageNames),
+                blobTables.at(0),
+                data::pack(builder, musicNames),
+                blobTables.at(1),
+                data::pack(builder, characterNames),
+                data::pack(builder, phrases, phraseOptions),
+                builder.CreateVectorOfStructs(showTextActions),
+                builder.CreateVectorOfStructs(actions),
+                imagePixels.empty() ?
+                    0 : builder.CreateVectorOfStructs(imagePixels),
+                formatVersion,
+                hasControlFlow ?
+                    programFormatVersion : compatibleFormatVersion,
+                hasControlFlow ? builder.CreateVector(code) : 0,
+                hasControlFlow ? data::pack(builder, variableNames) : 0,
+                builder.CreateVectorOfStructs(keyframes),
+                hasControlFlow ? builder.CreateVector(actionOffsets) : 0).Union();
+        },
+        blobOptions,
+        fb::BookaIdentifier());
 }
 
 } // namespace booka
@@ -1,21 +1,36 @@
 #include "booka.hpp"
+#include "interpreter.hpp"
+#include "script.hpp"
 #include "unpacked_booka.hpp"
 
 #include "arg.hpp"
+#include "audio.hpp"
 #include "error.hpp"
 #include "fs.hpp"
 #include "logging.hpp"
 #include "overloaded.hpp"
+#include "pixels.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
 #include <cstdlib>
 #include <exception>
 #include <filesystem>
-#include <fstream>
-#include <iostream>
 #include <istream>
 #include <map>
-#include <regex>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <span>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
 
 namespace fs = std::filesystem;
 
@@ -50,78 +65,381 @@ std::istream& operator>>(std::istream& input, Action& action)
     return input;
 }
 
-void encode(const fs::path& inputFilePath, const fs::path& outputFilePath)
-{
-    auto input = std::ifstream{inputFilePath};
-    input.exceptions(std::ios::badbit);
-
-    std::string character;
-    std::map<std::string, uint32_t> imageIndices;
-    std::map<std::string, uint32_t> musicIndices;
-
-    auto unpackedBooka = booka::UnpackedBooka{};
-    for (std::string line; std::getline(input, line); ) {
-        auto match = std::smatch{};
-
-        if (line.empty()) {
-            character = "";
-        } else if (line.starts_with("[")) {
-            if (std::regex_match(
-                    line,
-                    match,
-                    std::regex{R"_(\[фон "([^"\]]+)" ([^\]]+)\])_"})) {
-                auto imageName = match[1];
-                auto imagePath = inputFilePath.parent_path() / fs::path{match[2].str()};
-                auto imageData = file::read(imagePath);
-                std::cout << "image '" << imageName << "': " << Size{imageData.size()} << "\n";
-                imageIndices[imageName] = (uint32_t)unpackedBooka.imageNames.size();
-                unpackedBooka.imageNames.push_back(imageName);
-                unpackedBooka.imageData.push_back(imageData);
-            } else if (std::regex_match(
-                    line,
-                    match,
-                    std::regex{R"_(\[музыка "([^"\]]+)" ([^\]]+)\])_"})) {
-                auto musicName = match[1];
-                auto musicPath = inputFilePath.parent_path() / fs::path{match[2].str()};
-                auto musicData = file::read(musicPath);
-                std::cout << "music '" << musicName << "': " << Size{musicData.size()} << "\n";
-                musicIndices[musicName] = (uint32_t)unpackedBooka.musicNames.size();
-                unpackedBooka.musicNames.push_back(musicName);
-                unpackedBooka.musicData.push_back(musicData);
-            } else {
-                throw Error{} << "unknown directive: " << line;
+namespace data::fb {
+
+namespace {
+
+const std::map<std::string, Codec> codecNames {
+    {"lz4", Codec::Lz4},
+    {"none", Codec::None},
+    {"zstd", Codec::Zstd},
+};
+
+const std::map<std::string, StringsEncoding> stringsEncodingNames {
+    {"front-coded", StringsEncoding::FrontCoded},
+    {"interned", StringsEncoding::Interned},
+    {"plain", StringsEncoding::Plain},
+};
+
+} // namespace
+
+std::istream& operator>>(std::istream& input, Codec& codec)
+{
+    std::string s;
+    input >> s;
+    if (auto i = codecNames.find(s); i != codecNames.end()) {
+        codec = i->second;
+    } else {
+        throw Error{} << "unknown codec: " << s <<
+            "; valid values: lz4, none, zstd";
+    }
+    return input;
+}
+
+std::ostream& operator<<(std::ostream& output, Codec codec)
+{
+    for (const auto& [name, value] : codecNames) {
+        if (value == codec) {
+            return output << name;
+        }
+    }
+    return output << static_cast<int>(codec);
+}
+
+std::istream& operator>>(std::istream& input, StringsEncoding& encoding)
+{
+    std::string s;
+    input >> s;
+    if (auto i = stringsEncodingNames.find(s); i != stringsEncodingNames.end()) {
+        encoding = i->second;
+    } else {
+        throw Error{} << "unknown strings encoding: " << s <<
+            "; valid values: front-coded, interned, plain";
+    }
+    return input;
+}
+
+std::ostream& operator<<(std::ostream& output, StringsEncoding encoding)
+{
+    for (const auto& [name, value] : stringsEncodingNames) {
+        if (value == encoding) {
+            return output << name;
+        }
+    }
+    return output << static_cast<int>(encoding);
+}
+
+} // namespace data::fb
+
+void encode(
+    const fs::path& inputFilePath,
+    const fs::path& outputFilePath,
+    const fs::path& depfilePath,
+    bool decodeImages,
+    const std::optional<audio::TranscodeOptions>& audioOptions,
+    const data::BinaryDataPackOptions& blobOptions,
+    const data::StringsPackOptions& phraseOptions,
+    uint32_t keyframeInterval)
+{
+    auto unpackedBooka = booka::parseScript(inputFilePath);
+    unpackedBooka.keyframeInterval = keyframeInterval;
+
+    for (size_t i = 0; i < unpackedBooka.imageNames.size(); i++) {
+        LOG(Info) << "image '" << unpackedBooka.imageNames.at(i) << "': " <<
+            Size{fs::file_size(unpackedBooka.imagePaths.at(i))};
+    }
+    for (size_t i = 0; i < unpackedBooka.musicNames.size(); i++) {
+        LOG(Info) << "music '" << unpackedBooka.musicNames.at(i) << "': " <<
+            Size{fs::file_size(unpackedBooka.musicPaths.at(i))};
+    }
+    if (logging::enabled(logging::Level::Debug)) {
+        for (const auto& action : unpackedBooka.actions) {
+            if (const auto* text =
+                    std::get_if<booka::UnpackedShowTextAction>(&action)) {
+                LOG(Debug) << "[" << text->character << "] " << text->text;
             }
-        } else if (std::regex_match(line, match, std::regex{"\\(фон: (.*)\\)"})) {
-            auto imageName = match[1];
-            auto imageIndex = imageIndices.at(imageName);
-            unpackedBooka.actions.emplace_back(
-                booka::UnpackedShowImageAction{.imageIndex = imageIndex});
-        } else if (std::regex_match(line, match, std::regex{"\\(музыка: (.*)\\)"})) {
-            auto musicName = match[1];
-            auto musicIndex = musicIndices.at(musicName);
-            unpackedBooka.actions.emplace_back(
-                booka::UnpackedPlayMusicAction{.musicIndex = musicIndex});
-        } else if (std::regex_match(line, match, std::regex{"\\(.*\\)"})) {
-            unpackedBooka.actions.emplace_back(
-                booka::UnpackedShowTextAction{.character = "", .text = line});
-            std::cout << "[] " << line << "\n";
-        } else if (std::regex_match(line, match, std::regex{"(.+):\\s*(.*)"})) {
-            character = match[1];
-            const auto& phrase = match[2];
-            unpackedBooka.actions.emplace_back(
-                booka::UnpackedShowTextAction{
-                    .character = character, .text = phrase});
-            std::cout << "[" << character << "] " << phrase << "\n";
-        } else {
-            unpackedBooka.actions.emplace_back(
-                booka::UnpackedShowTextAction{.character = character, .text = line});
-            std::cout << "[" << character << "] " << line << "\n";
-        }
-    }
-
-    unpackedBooka.pack(outputFilePath);
+        }
+    }
+
+    auto dependencies = std::vector<fs::path>{inputFilePath};
+    dependencies.insert(
+        dependencies.end(),
+        unpackedBooka.imagePaths.begin(),
+        unpackedBooka.imagePaths.end());
+    dependencies.insert(
+        dependencies.end(),
+        unpackedBooka.musicPaths.begin(),
+        unpackedBooka.musicPaths.end());
+
+    // Decoded images and transcoded music are kept in the cache directory, so
+    // that unchanged files are not decoded or transcoded again by the next
+    // build. Without a cache, they go to temporary directories next to the
+    // output.
+    const bool cached = !blobOptions.cacheDirectory.empty();
+    auto transformDirectory = [&] (const std::string& name) {
+        if (cached) {
+            return blobOptions.cacheDirectory / name;
+        }
+        auto directory = outputFilePath;
+        directory += "." + name;
+        return directory;
+    };
+    auto pixelsDirectory = fs::path{};
+    if (decodeImages) {
+        pixelsDirectory = transformDirectory("pixels");
+        auto decoded = pixels::decodeToDirectory(
+            unpackedBooka.imagePaths, pixelsDirectory);
+        unpackedBooka.imagePaths = std::move(decoded.paths);
+        unpackedBooka.imagePixels = std::move(decoded.infos);
+    }
+    auto audioDirectory = fs::path{};
+    if (audioOptions) {
+        audioDirectory = transformDirectory("audio");
+        unpackedBooka.musicPaths = audio::transcodeToDirectory(
+            unpackedBooka.musicPaths, audioDirectory, *audioOptions);
+    }
+
+    auto report = unpackedBooka.pack(outputFilePath, blobOptions, phraseOptions);
+    LOG(Info) << "packed " << outputFilePath << ": " << report;
+
+    for (const auto& directory : {pixelsDirectory, audioDirectory}) {
+        if (!cached && !directory.empty()) {
+            fs::remove_all(directory);
+        }
+    }
+    if (!depfilePath.empty()) {
+        file::writeDepfile(depfilePath, outputFilePath, dependencies);
+    }
 }
 
+namespace {
+
+// Runs of whitespace in a name become single underscores
+std::string fileBaseName(std::string_view name)
+{
+    auto baseName = std::string{};
+    bool afterSpace = false;
+    for (char c : name) {
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            afterSpace = true;
+            continue;
+        }
+        if (afterSpace) {
+            baseName += '_';
+            afterSpace = false;
+        }
+        baseName += c;
+    }
+    if (afterSpace) {
+        baseName += '_';
+    }
+    return baseName;
+}
+
+// Base names of files for all names, made unique with a suffix where they
+// collide, ignoring case as some file systems do, so that no two blobs are
+// written to the same file
+std::vector<std::string> fileBaseNames(const data::Strings& names)
+{
+    auto folded = [] (std::string name) {
+        std::ranges::transform(name, name.begin(), [] (char c) {
+            return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        });
+        return name;
+    };
+
+    auto baseNames = std::vector<std::string>{};
+    auto taken = std::set<std::string>{};
+    for (const auto name : names) {
+        const auto baseName = fileBaseName(name);
+        auto unique = baseName;
+        for (size_t n = 1; !taken.insert(folded(unique)).second; n++) {
+            unique = baseName + "-" + std::to_string(n);
+        }
+        baseNames.push_back(std::move(unique));
+    }
+    return baseNames;
+}
+
+std::string_view musicExtension(std::span<const std::byte> data)
+{
+    auto startsWith = [data] (std::string_view magic) {
+        return data.size() >= magic.size() &&
+            std::equal(magic.begin(), magic.end(), data.begin(),
+                [] (char lhs, std::byte rhs) {
+                    return static_cast<std::byte>(lhs) == rhs;
+                });
+    };
+    if (startsWith("OggS")) {
+        return ".ogg";
+    }
+    if (startsWith("fLaC")) {
+        return ".flac";
+    }
+    if (startsWith("ID3")) {
+        return ".mp3";
+    }
+    return ".wav";
+}
+
+// Write a blob to a file. Blobs stored uncompressed are copied straight from
+// the booka file, without being read into memory.
+void extract(
+    const booka::Booka& booka,
+    const fs::path& bookaPath,
+    std::span<const std::byte> blob,
+    const fs::path& outputPath)
+{
+    const auto buffer = booka.buffer();
+    const auto blobAddress = reinterpret_cast<uintptr_t>(blob.data());
+    const auto bufferAddress = reinterpret_cast<uintptr_t>(buffer.data());
+    if (blobAddress >= bufferAddress &&
+            blobAddress + blob.size() <= bufferAddress + buffer.size()) {
+        file::copyRange(
+            bookaPath, blobAddress - bufferAddress, blob.size(), outputPath);
+    } else {
+        file::write(outputPath, blob);
+    }
+}
+
+void writeAction(
+    const booka::Booka& booka, const booka::Action& action, std::string& script)
+{
+    std::visit(Overloaded{
+        [&] (const booka::ShowImageAction& action) {
+            script += "[";
+            script += booka.images().names()[action.imageIndex];
+            script += "]\n";
+        },
+        [&] (const booka::PlayMusicAction& action) {
+            script += "[";
+            script += booka.music().names()[action.musicIndex];
+            script += "]\n";
+        },
+        [&] (const booka::ShowTextAction& action) {
+            if (!action.character.empty()) {
+                script += action.character;
+                script += ": ";
+            }
+            script += action.text;
+            script += "\n";
+        },
+        [] (const booka::UnknownAction&) {}
+    }, action);
+}
+
+std::string_view comparisonText(booka::fb::Comparison comparison)
+{
+    switch (comparison) {
+        case booka::fb::Comparison::Equal: return "==";
+        case booka::fb::Comparison::NotEqual: return "!=";
+        case booka::fb::Comparison::Less: return "<";
+        case booka::fb::Comparison::LessEqual: return "<=";
+        case booka::fb::Comparison::Greater: return ">";
+        case booka::fb::Comparison::GreaterEqual: return ">=";
+    }
+    throw Error{} << "unknown comparison " << static_cast<int>(comparison);
+}
+
+// Write the story program back as script directives (see parseScript), with
+// labels named after the words of the program they mark
+void writeProgram(
+    const booka::Booka& booka,
+    const flatbuffers::Vector<uint32_t>& code,
+    std::string& script)
+{
+    using booka::fb::Opcode;
+
+    auto opcode = [&] (uint32_t offset) {
+        return static_cast<Opcode>(code.Get(offset) & 0xff);
+    };
+    auto labels = std::set<uint32_t>{};
+    for (uint32_t offset = 0; offset < code.size();
+            offset += booka::instructionSize(&code, offset)) {
+        if (opcode(offset) == Opcode::Jump) {
+            labels.insert(code.Get(offset + 1));
+        } else if (opcode(offset) == Opcode::JumpIf) {
+            labels.insert(code.Get(offset + 3));
+        } else if (opcode(offset) == Opcode::Choice) {
+            for (uint32_t i = 0; i < code.Get(offset + 1); i++) {
+                labels.insert(code.Get(offset + 3 + 2 * i));
+            }
+        }
+    }
+    auto label = [] (uint32_t offset) {
+        return "L" + std::to_string(offset);
+    };
+
+    const auto& phrases = booka.phrases();
+    const auto& variableNames = booka.variableNames();
+    auto variable = [&] (uint32_t slot) {
+        return std::string{(*variableNames)[slot]};
+    };
+    auto value = [] (uint32_t word) {
+        return std::to_string(static_cast<int32_t>(word));
+    };
+    for (uint32_t offset = 0; offset < code.size();
+            offset += booka::instructionSize(&code, offset)) {
+        if (labels.contains(offset)) {
+            script += "(метка: " + label(offset) + ")\n";
+        }
+        switch (opcode(offset)) {
+            case Opcode::Show:
+                writeAction(booka, booka.actions()[code.Get(offset + 1)], script);
+                break;
+            case Opcode::Jump:
+                script += "(переход: " + label(code.Get(offset + 1)) + ")\n";
+                break;
+            case Opcode::JumpIf:
+                script += "(если: " + variable(code.Get(offset + 1)) + " " +
+                    std::string{comparisonText(static_cast<booka::fb::Comparison>(
+                        code.Get(offset) >> 8))} + " " +
+                    value(code.Get(offset + 2)) + ", переход: " +
+                    label(code.Get(offset + 3)) + ")\n";
+                break;
+            case Opcode::Choice:
+                for (uint32_t i = 0; i < code.Get(offset + 1); i++) {
+                    script += "* ";
+                    script += phrases[code.Get(offset + 2 + 2 * i)];
+                    script += " -> " + label(code.Get(offset + 3 + 2 * i)) + "\n";
+                }
+                break;
+            case Opcode::Set:
+                script += "(пусть: " + variable(code.Get(offset + 1)) + " = " +
+                    value(code.Get(offset + 2)) + ")\n";
+                break;
+            case Opcode::Add:
+                script += "(пусть: " + variable(code.Get(offset + 1)) + " += " +
+                    value(code.Get(offset + 2)) + ")\n";
+                break;
+            case Opcode::Finish:
+                // The program always ends with one, which encode adds again
+                if (offset + 1 < code.size()) {
+                    script += "(конец)\n";
+                }
+                break;
+        }
+    }
+}
+
+void writeScript(const booka::Booka& booka, const fs::path& outputPath)
+{
+    auto script = std::string{};
+    if (const auto* code = booka.code()) {
+        writeProgram(booka, *code, script);
+    } else {
+        for (const auto& action : booka.actions()) {
+            writeAction(booka, action, script);
+        }
+    }
+    file::write(outputPath, std::as_bytes(std::span{script}));
+}
+
+} // namespace
+
+// Extract the script, images and music on one thread per hardware thread.
+// A blob decompressed by one thread stays valid while it is being written,
+// even if other threads evict it from the cache.
 void decode(const fs::path& inputFilePath, const fs::path& outputDirectoryPath)
 {
     if (fs::exists(outputDirectoryPath)) {
@@ -129,39 +447,73 @@ void decode(const fs::path& inputFilePath, const fs::path& outputDirectoryPath)
     }
     fs::create_directory(outputDirectoryPath);
     fs::create_directory(outputDirectoryPath / "images");
+    fs::create_directory(outputDirectoryPath / "music");
+
+    const auto booka = booka::Booka{inputFilePath, {.verify = true}};
+    const size_t imageCount = booka.images().size();
+    const size_t musicCount = booka.music().size();
+    // Task 0 is the script, followed by images, followed by music
+    const size_t taskCount = 1 + imageCount + musicCount;
+    const auto imageBaseNames = fileBaseNames(booka.images().names());
+    const auto musicBaseNames = fileBaseNames(booka.music().names());
 
-    auto booka = booka::Booka{inputFilePath};
-    for (const auto& image : booka.images()) {
-        auto baseName = std::regex_replace(
-            std::string{image.name}, std::regex{"\\s+"}, "_");
-        auto filePath = outputDirectoryPath / "images" / baseName;
-        filePath.replace_extension(".png");
-
-        auto output = std::ofstream{filePath, std::ios::binary};
-        output.exceptions(std::ios::badbit | std::ios::failbit);
-        output.write(
-            reinterpret_cast<const char*>(image.data.data()),
-            static_cast<std::streamsize>(image.data.size()));
-    }
-
-    auto output = std::ofstream{outputDirectoryPath / "script.txt"};
-    output.exceptions(std::ios::badbit | std::ios::failbit);
-    for (const auto& action : booka.actions()) {
-        std::visit(Overloaded{
-            [&] (const booka::ShowImageAction& action) {
-                output << "[" <<
-                    booka.images()[action.imageIndex].name << "]\n";
-            },
-            [&] (const booka::PlayMusicAction& action) {
-                output << "[" << booka.music()[action.musicIndex].name << "]\n";
-            },
-            [&] (const booka::ShowTextAction& action) {
-                if (!action.character.empty()) {
-                    output << action.character << ": ";
+    auto nextTask = std::atomic<size_t>{0};
+    auto errorMutex = std::mutex{};
+    auto error = std::exception_ptr{};
+
+    auto runTasks = [&] {
+        for (size_t task = nextTask++; task < taskCount; task = nextTask++) {
+            if (task == 0) {
+                writeScript(booka, outputDirectoryPath / "script.txt");
+            } else if (task <= imageCount) {
+                const auto imageIndex = uint32_t(task - 1);
+                const auto image = booka.images()[imageIndex];
+                const auto imagePath = outputDirectoryPath / "images" /
+                    (imageBaseNames.at(imageIndex) + ".png");
+                // Images packed with --pixels are rows of pixels, which are
+                // encoded again to be usable as the script's images
+                if (const auto pixels = booka.imagePixels(imageIndex)) {
+                    pixels::writePng(*pixels, image.data, imagePath);
+                } else {
+                    extract(booka, inputFilePath, image.data, imagePath);
                 }
-                output << action.text << "\n";
+            } else {
+                const auto musicIndex = uint32_t(task - 1 - imageCount);
+                const auto music = booka.music()[musicIndex];
+                extract(
+                    booka,
+                    inputFilePath,
+                    music.data,
+                    outputDirectoryPath / "music" /
+                        (musicBaseNames.at(musicIndex) +
+                            std::string{musicExtension(music.data)}));
             }
-        }, action);
+        }
+    };
+    auto work = [&] {
+        try {
+            runTasks();
+        } catch (...) {
+            nextTask = taskCount;
+            auto lock = std::lock_guard{errorMutex};
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    {
+        const size_t threadCount = std::min<size_t>(
+            std::max(std::thread::hardware_concurrency(), 1u), taskCount);
+        auto threads = std::vector<std::jthread>{};
+        for (size_t i = 1; i < threadCount; i++) {
+            threads.emplace_back(work);
+        }
+        work();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
     }
 }
 
@@ -180,6 +532,49 @@ int main(int argc, char* argv[]) try
         .keys("--output")
         .markRequired()
         .help("path to output file");
+    auto codec = parser.option<data::fb::Codec>()
+        .keys("--codec")
+        .defaultValue(data::fb::Codec::None)
+        .help("compress images and music: none, lz4 or zstd");
+    auto alignment = parser.option<size_t>()
+        .keys("--alignment")
+        .defaultValue(1)
+        .help("align each image and music blob to this many bytes");
+    auto phraseEncoding = parser.option<data::fb::StringsEncoding>()
+        .keys("--phrase-encoding")
+        .defaultValue(data::fb::StringsEncoding::Plain)
+        .help("store phrases as plain, interned or front-coded strings");
+    auto decodeImages = parser.flag()
+        .keys("--pixels")
+        .help("when encoding, store images decoded into pixels, ready to be "
+            "uploaded to textures");
+    auto transcodeAudio = parser.flag()
+        .keys("--transcode-audio")
+        .help("when encoding, convert WAV music to Ogg Vorbis at --audio-rate");
+    auto audioRate = parser.option<int>()
+        .keys("--audio-rate")
+        .defaultValue(48000)
+        .help("sample rate to resample music to, matching the game's audio "
+            "frequency");
+    auto audioQuality = parser.option<float>()
+        .keys("--audio-quality")
+        .defaultValue(0.4f)
+        .help("Vorbis quality of transcoded music, from -0.1 to 1");
+    auto keyframeInterval = parser.option<uint32_t>()
+        .keys("--keyframe-interval")
+        .defaultValue(booka::defaultKeyframeInterval)
+        .help("when encoding, actions between keyframes for seeking, besides "
+            "those at chapters; 0 for keyframes at chapters only");
+    auto depfile = parser.option<fs::path>()
+        .keys("--depfile")
+        .defaultValue(fs::path{})
+        .help("when encoding, write a Makefile-style depfile listing the "
+            "script, images and music");
+    auto cacheDirectory = parser.option<fs::path>()
+        .keys("--cache-dir")
+        .defaultValue(fs::path{})
+        .help("when encoding, reuse compressed blobs and unchanged output "
+            "from this directory");
     parser.helpKeys("-h", "--help");
     parser.parse(argc, argv);
 
@@ -188,11 +583,32 @@ int main(int argc, char* argv[]) try
             decode(input, output);
             break;
         case Action::Encode:
-            encode(input, output);
+        {
+            auto blobOptions = data::BinaryDataPackOptions{};
+            blobOptions.codec = codec;
+            blobOptions.alignment = alignment;
+            blobOptions.cacheDirectory = cacheDirectory;
+            auto audioOptions = std::optional<audio::TranscodeOptions>{};
+            if (transcodeAudio) {
+                audioOptions = audio::TranscodeOptions{
+                    .sampleRate = audioRate,
+                    .quality = audioQuality,
+                };
+            }
+            encode(
+                input,
+                output,
+                depfile,
+                decodeImages,
+                audioOptions,
+                blobOptions,
+                {.encoding = phraseEncoding},
+                keyframeInterval);
             break;
+        }
     }
 
 } catch (const std::exception& e) {
-    std::cerr << e.what() << "\n";
+    LOG(Error) << e.what();
     return EXIT_FAILURE;
 }
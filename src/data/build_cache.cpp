@@ -0,0 +1,257 @@
+#include "build_cache.hpp"
+
+#include "hash.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace data {
+
+namespace {
+
+constexpr std::string_view payloadHeader = "dinner-pack-payload 1";
+constexpr std::string_view layoutHeader = "dinner-pack-layout 2";
+constexpr std::string_view temporaryMarker = ".tmp-";
+
+std::string hex(uint64_t value)
+{
+    auto stream = std::ostringstream{};
+    stream << std::hex << std::setw(16) << std::setfill('0') << value;
+    return stream.str();
+}
+
+// Write to a temporary file next to path, and rename it into place, so that
+// readers never see a partially written entry
+void writeAtomically(
+    const fs::path& path, const std::function<void(std::ostream&)>& write)
+{
+    static std::atomic<uint64_t> counter = 0;
+
+    fs::create_directories(path.parent_path());
+    auto temporaryPath = path;
+    temporaryPath += std::string{temporaryMarker} +
+        hex(std::hash<std::thread::id>{}(std::this_thread::get_id())) + "-" +
+        std::to_string(counter++);
+    {
+        auto output = std::ofstream{};
+        output.exceptions(std::ios::badbit | std::ios::failbit);
+        output.open(temporaryPath, std::ios::binary | std::ios::trunc);
+        write(output);
+    }
+    fs::rename(temporaryPath, path);
+}
+
+// Entry being written by writeAtomically, possibly by another packer
+bool isTemporary(const fs::path& path)
+{
+    return path.filename().string().find(temporaryMarker) != std::string::npos;
+}
+
+} // namespace
+
+int64_t fileTime(const fs::path& path)
+{
+    return static_cast<int64_t>(
+        fs::last_write_time(path).time_since_epoch().count());
+}
+
+BuildCache::BuildCache(fs::path directory)
+    : _directory(std::move(directory))
+{
+    fs::create_directories(_directory);
+}
+
+std::optional<CachedPayload> BuildCache::payload(
+    uint64_t hash, fb::Codec codec, uint32_t size) const
+{
+    auto input = std::ifstream{payloadPath(hash, codec), std::ios::binary};
+    auto header = std::string{};
+    if (!std::getline(input, header) || header != payloadHeader) {
+        return std::nullopt;
+    }
+
+    int requestedCodec = 0;
+    int storedCodec = 0;
+    auto payload = CachedPayload{};
+    uint64_t storedSize = 0;
+    input >> requestedCodec >> storedCodec >> payload.size >> storedSize;
+    input.ignore(1);
+    payload.codec = static_cast<fb::Codec>(storedCodec);
+    if (!input ||
+            static_cast<fb::Codec>(requestedCodec) != codec ||
+            (payload.codec != codec && payload.codec != fb::Codec::None) ||
+            payload.size != size) {
+        return std::nullopt;
+    }
+
+    payload.stored.resize(storedSize);
+    input.read(
+        reinterpret_cast<char*>(payload.stored.data()),
+        static_cast<std::streamsize>(storedSize));
+    if (static_cast<uint64_t>(input.gcount()) != storedSize) {
+        return std::nullopt;
+    }
+    return payload;
+}
+
+void BuildCache::storePayload(
+    uint64_t hash, fb::Codec codec, const CachedPayload& payload) const
+{
+    writeAtomically(
+        payloadPath(hash, codec), [codec, &payload] (std::ostream& output) {
+            output << payloadHeader << "\n" << static_cast<int>(codec) << " " <<
+                static_cast<int>(payload.codec) << " " << payload.size << " " <<
+                payload.stored.size() << "\n";
+            output.write(
+                reinterpret_cast<const char*>(payload.stored.data()),
+                static_cast<std::streamsize>(payload.stored.size()));
+        });
+}
+
+std::optional<PackedLayout> BuildCache::layout(const fs::path& outputPath) const
+{
+    auto stored = readLayout(layoutPath(outputPath));
+    if (!stored ||
+            stored->outputPath != fs::absolute(outputPath).lexically_normal()) {
+        return std::nullopt;
+    }
+    return std::move(stored->layout);
+}
+
+std::optional<BuildCache::StoredLayout> BuildCache::readLayout(
+    const fs::path& path)
+{
+    auto input = std::ifstream{path};
+    auto header = std::string{};
+    if (!std::getline(input, header) || header != layoutHeader) {
+        return std::nullopt;
+    }
+
+    auto stored = StoredLayout{};
+    auto outputPathString = std::string{};
+    std::getline(input, outputPathString);
+    stored.outputPath =
+        std::u8string{outputPathString.begin(), outputPathString.end()};
+
+    auto& layout = stored.layout;
+    int codec = 0;
+    size_t inputCount = 0;
+    input >> codec >> layout.alignment >> layout.deduplicate >>
+        layout.blobsStart >> layout.outputSize >> layout.outputTime >> inputCount;
+    layout.codec = static_cast<fb::Codec>(codec);
+
+    for (size_t i = 0; i < inputCount && input; i++) {
+        auto packedInput = PackedInput{};
+        int inputCodec = 0;
+        input >> packedInput.hash >> inputCodec >> packedInput.size >>
+            packedInput.storedSize >> packedInput.offset >>
+            packedInput.checksum >> packedInput.fileSize >>
+            packedInput.fileTime;
+        input.ignore(1);
+        auto pathString = std::string{};
+        std::getline(input, pathString);
+        packedInput.codec = static_cast<fb::Codec>(inputCodec);
+        packedInput.path = std::u8string{pathString.begin(), pathString.end()};
+        layout.inputs.push_back(std::move(packedInput));
+    }
+
+    if (!input || layout.inputs.size() != inputCount) {
+        return std::nullopt;
+    }
+    return stored;
+}
+
+void BuildCache::storeLayout(
+    const fs::path& outputPath, const PackedLayout& layout) const
+{
+    const auto key = fs::absolute(outputPath).lexically_normal().u8string();
+    writeAtomically(layoutPath(outputPath), [&] (std::ostream& output) {
+        output << layoutHeader << "\n" <<
+            std::string{key.begin(), key.end()} << "\n" <<
+            static_cast<int>(layout.codec) << " " << layout.alignment << " " <<
+            layout.deduplicate << " " << layout.blobsStart << " " <<
+            layout.outputSize << " " << layout.outputTime << " " <<
+            layout.inputs.size() << "\n";
+        for (const auto& input : layout.inputs) {
+            const auto path = input.path.u8string();
+            output << input.hash << " " << static_cast<int>(input.codec) <<
+                " " << input.size << " " << input.storedSize << " " <<
+                input.offset << " " << input.checksum << " " <<
+                input.fileSize << " " << input.fileTime << " " <<
+                std::string{path.begin(), path.end()} << "\n";
+        }
+    });
+}
+
+void BuildCache::prune() const
+{
+    auto referenced = std::set<fs::path>{};
+    const auto outputsDirectory = _directory / "outputs";
+    if (fs::exists(outputsDirectory)) {
+        for (const auto& entry : fs::directory_iterator{outputsDirectory}) {
+            if (isTemporary(entry.path())) {
+                continue;
+            }
+            const auto stored = readLayout(entry.path());
+            if (!stored || !fs::exists(stored->outputPath)) {
+                fs::remove(entry.path());
+                continue;
+            }
+            for (const auto& input : stored->layout.inputs) {
+                referenced.insert(payloadPath(input.hash, stored->layout.codec));
+            }
+        }
+    }
+
+    const auto blobsDirectory = _directory / "blobs";
+    if (fs::exists(blobsDirectory)) {
+        for (const auto& entry : fs::directory_iterator{blobsDirectory}) {
+            if (!isTemporary(entry.path()) &&
+                    !referenced.contains(entry.path())) {
+                fs::remove(entry.path());
+            }
+        }
+    }
+}
+
+std::optional<BinaryDataPackOptions> cachedPackOptions(
+    const fs::path& cacheDirectory, const fs::path& outputPath)
+{
+    if (cacheDirectory.empty() || !fs::exists(cacheDirectory)) {
+        return std::nullopt;
+    }
+    const auto layout = BuildCache{cacheDirectory}.layout(outputPath);
+    if (!layout) {
+        return std::nullopt;
+    }
+    auto options = BinaryDataPackOptions{};
+    options.codec = layout->codec;
+    options.alignment = layout->alignment;
+    options.deduplicate = layout->deduplicate;
+    options.cacheDirectory = cacheDirectory;
+    return options;
+}
+
+fs::path BuildCache::payloadPath(uint64_t hash, fb::Codec codec) const
+{
+    return _directory / "blobs" /
+        (hex(hash) + "-" + std::to_string(static_cast<int>(codec)));
+}
+
+fs::path BuildCache::layoutPath(const fs::path& outputPath) const
+{
+    const auto key = fs::absolute(outputPath).lexically_normal().u8string();
+    return _directory / "outputs" /
+        hex(hash64(std::as_bytes(std::span{key.data(), key.size()})));
+}
+
+} // namespace data
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "data.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace data {
+
+// Where, and as what, one input file was stored in a packed output
+struct PackedInput {
+    std::filesystem::path path;
+    uint64_t fileSize = 0;
+    int64_t fileTime = 0;
+    uint64_t hash = 0;
+    fb::Codec codec = fb::Codec::None;
+    uint32_t size = 0;
+    uint32_t storedSize = 0;
+    uint64_t offset = 0;
+    uint32_t checksum = 0;
+};
+
+// Blobs of a packed output file, as written by packStreaming. The flatbuffer
+// takes the first blobsStart bytes of the file, padded with zeros.
+struct PackedLayout {
+    fb::Codec codec = fb::Codec::None;
+    uint64_t alignment = 1;
+    bool deduplicate = true;
+    uint64_t blobsStart = 0;
+    uint64_t outputSize = 0;
+    int64_t outputTime = 0;
+    std::vector<PackedInput> inputs;
+};
+
+// Blob as compressed for the cache. Stored bytes are empty if compression did
+// not make the blob smaller, and it is stored as it is.
+struct CachedPayload {
+    // Size of the blob before compression
+    uint32_t size = 0;
+    fb::Codec codec = fb::Codec::None;
+    std::vector<std::byte> stored;
+};
+
+int64_t fileTime(const std::filesystem::path& path);
+
+// Content-addressed cache of packed blobs, and the layout of every output
+// packed with it. Payloads are keyed by content hash and requested codec, so
+// that a blob is compressed once, whichever output and input path it comes
+// from. Entries are written to temporary files and renamed into place, so
+// several packers may share a cache directory.
+class BuildCache {
+public:
+    explicit BuildCache(std::filesystem::path directory);
+
+    // Payload of a blob with the given hash and size, compressed with codec.
+    // An entry for a blob of another size, or compressed with another codec,
+    // is not returned, so that a hash collision is not trusted blindly.
+    [[nodiscard]] std::optional<CachedPayload> payload(
+        uint64_t hash, fb::Codec codec, uint32_t size) const;
+    void storePayload(
+        uint64_t hash, fb::Codec codec, const CachedPayload& payload) const;
+
+    [[nodiscard]] std::optional<PackedLayout> layout(
+        const std::filesystem::path& outputPath) const;
+    void storeLayout(
+        const std::filesystem::path& outputPath,
+        const PackedLayout& layout) const;
+
+    // Remove layouts of outputs that no longer exist, and payloads that no
+    // remaining layout references. A payload stored by a packer still running
+    // may be removed too, which only costs compressing it again next time.
+    void prune() const;
+
+private:
+    struct StoredLayout {
+        std::filesystem::path outputPath;
+        PackedLayout layout;
+    };
+
+    [[nodiscard]] static std::optional<StoredLayout> readLayout(
+        const std::filesystem::path& path);
+
+    [[nodiscard]] std::filesystem::path payloadPath(
+        uint64_t hash, fb::Codec codec) const;
+    [[nodiscard]] std::filesystem::path layoutPath(
+        const std::filesystem::path& outputPath) const;
+
+    std::filesystem::path _directory;
+};
+
+} // namespace data
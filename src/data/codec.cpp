@@ -0,0 +1,139 @@
+#include "codec.hpp"
+
+#include "error.hpp"
+
+#ifdef DATA_WITH_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#ifdef DATA_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace data {
+
+bool codecAvailable(fb::Codec codec)
+{
+    switch (codec) {
+        case fb::Codec::None:
+            return true;
+        case fb::Codec::Lz4:
+#ifdef DATA_WITH_LZ4
+            return true;
+#else
+            return false;
+#endif
+        case fb::Codec::Zstd:
+#ifdef DATA_WITH_ZSTD
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+std::vector<std::byte> compress(
+    fb::Codec codec, std::span<const std::byte> data)
+{
+    if (!codecAvailable(codec)) {
+        throw Error{} << "codec not available in this build: " <<
+            fb::EnumNameCodec(codec);
+    }
+
+    switch (codec) {
+        case fb::Codec::None:
+            return {data.begin(), data.end()};
+        case fb::Codec::Lz4:
+        {
+#ifdef DATA_WITH_LZ4
+            auto result = std::vector<std::byte>(
+                LZ4_compressBound(static_cast<int>(data.size())));
+            const int size = LZ4_compress_HC(
+                reinterpret_cast<const char*>(data.data()),
+                reinterpret_cast<char*>(result.data()),
+                static_cast<int>(data.size()),
+                static_cast<int>(result.size()),
+                LZ4HC_CLEVEL_DEFAULT);
+            if (size <= 0) {
+                throw Error{} << "LZ4 compression failed";
+            }
+            result.resize(size);
+            return result;
+#endif
+            break;
+        }
+        case fb::Codec::Zstd:
+        {
+#ifdef DATA_WITH_ZSTD
+            auto result = std::vector<std::byte>(ZSTD_compressBound(data.size()));
+            const size_t size = ZSTD_compress(
+                result.data(), result.size(), data.data(), data.size(), 19);
+            if (ZSTD_isError(size)) {
+                throw Error{} << "zstd compression failed: " <<
+                    ZSTD_getErrorName(size);
+            }
+            result.resize(size);
+            return result;
+#endif
+            break;
+        }
+    }
+
+    throw Error{} << "unknown codec: " << static_cast<int>(codec);
+}
+
+std::vector<std::byte> decompress(
+    fb::Codec codec,
+    std::span<const std::byte> data,
+    [[maybe_unused]] size_t decompressedSize)
+{
+    if (!codecAvailable(codec)) {
+        throw Error{} << "codec not available in this build: " <<
+            fb::EnumNameCodec(codec);
+    }
+
+    switch (codec) {
+        case fb::Codec::None:
+            return {data.begin(), data.end()};
+        case fb::Codec::Lz4:
+        {
+#ifdef DATA_WITH_LZ4
+            auto result = std::vector<std::byte>(decompressedSize);
+            const int size = LZ4_decompress_safe(
+                reinterpret_cast<const char*>(data.data()),
+                reinterpret_cast<char*>(result.data()),
+                static_cast<int>(data.size()),
+                static_cast<int>(result.size()));
+            if (size < 0 || static_cast<size_t>(size) != decompressedSize) {
+                throw Error{} << "LZ4 decompression failed";
+            }
+            return result;
+#endif
+            break;
+        }
+        case fb::Codec::Zstd:
+        {
+#ifdef DATA_WITH_ZSTD
+            auto result = std::vector<std::byte>(decompressedSize);
+            const size_t size = ZSTD_decompress(
+                result.data(), result.size(), data.data(), data.size());
+            if (ZSTD_isError(size)) {
+                throw Error{} << "zstd decompression failed: " <<
+                    ZSTD_getErrorName(size);
+            }
+            if (size != decompressedSize) {
+                throw Error{} << "zstd decompression failed: expected " <<
+                    decompressedSize << " bytes, got " << size;
+            }
+            return result;
+#endif
+            break;
+        }
+    }
+
+    throw Error{} << "unknown codec: " << static_cast<int>(codec);
+}
+
+} // namespace data
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "data_generated.h"
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace data {
+
+[[nodiscard]] bool codecAvailable(fb::Codec codec);
+
+std::vector<std::byte> compress(
+    fb::Codec codec, std::span<const std::byte> data);
+
+std::vector<std::byte> decompress(
+    fb::Codec codec, std::span<const std::byte> data, size_t decompressedSize);
+
+} // namespace data
@@ -1,9 +1,215 @@
 #include "data.hpp"
 
+#include "codec.hpp"
+#include "crc32c.hpp"
+#include "error.hpp"
+#include "hash.hpp"
+#include "logging.hpp"
+
+#include <algorithm>
+#include <concepts>
+#include <list>
+#include <mutex>
+#include <numeric>
+#include <unordered_map>
+
 namespace data {
 
 namespace {
 
+uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+uint64_t hash(std::string_view string, uint64_t seed)
+{
+    uint64_t h = 0xcbf29ce484222325ull ^ seed;
+    for (char c : string) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3ull;
+    }
+    return mix(h);
+}
+
+uint32_t slot(uint64_t hash, uint32_t displacement, size_t slotCount)
+{
+    return static_cast<uint32_t>(mix(hash + displacement) % slotCount);
+}
+
+struct NameIndex {
+    uint64_t seed = 0;
+    std::vector<uint32_t> displacements;
+    std::vector<uint32_t> slots;
+};
+
+// Hash and displace: strings are distributed into buckets by their hash, and
+// for each bucket, largest first, we search for a displacement that moves all
+// of its strings into free slots.
+NameIndex buildNameIndex(const std::vector<std::string>& strings)
+{
+    {
+        auto sorted = std::vector<std::string_view>(
+            strings.begin(), strings.end());
+        std::ranges::sort(sorted);
+        if (auto i = std::ranges::adjacent_find(sorted); i != sorted.end()) {
+            throw Error{} << "cannot index duplicate string: " << *i;
+        }
+    }
+
+    const size_t slotCount = strings.size();
+    const size_t bucketCount = std::max<size_t>(1, (slotCount + 3) / 4);
+    const size_t maxDisplacement = std::max<size_t>(1024, 16 * slotCount);
+
+    auto index = NameIndex{};
+    auto hashes = std::vector<uint64_t>(slotCount);
+    auto buckets = std::vector<std::vector<uint32_t>>(bucketCount);
+    auto bucketOrder = std::vector<uint32_t>(bucketCount);
+    auto bucketSlots = std::vector<uint32_t>{};
+    for (;; index.seed++) {
+        for (auto& bucket : buckets) {
+            bucket.clear();
+        }
+        for (uint32_t i = 0; i < slotCount; i++) {
+            hashes[i] = hash(strings[i], index.seed);
+            buckets[hashes[i] % bucketCount].push_back(i);
+        }
+
+        std::iota(bucketOrder.begin(), bucketOrder.end(), 0);
+        std::ranges::stable_sort(bucketOrder, [&buckets] (uint32_t l, uint32_t r) {
+            return buckets[l].size() > buckets[r].size();
+        });
+
+        index.displacements.assign(bucketCount, 0);
+        index.slots.assign(slotCount, uint32_t(-1));
+        bool success = true;
+        for (uint32_t bucketIndex : bucketOrder) {
+            const auto& bucket = buckets[bucketIndex];
+            if (bucket.empty()) {
+                break;
+            }
+
+            bool placed = false;
+            for (uint32_t d = 0; d < maxDisplacement && !placed; d++) {
+                bucketSlots.clear();
+                placed = true;
+                for (uint32_t i : bucket) {
+                    auto s = slot(hashes[i], d, slotCount);
+                    if (index.slots[s] != uint32_t(-1) ||
+                            std::ranges::find(bucketSlots, s) != bucketSlots.end()) {
+                        placed = false;
+                        break;
+                    }
+                    bucketSlots.push_back(s);
+                }
+                if (placed) {
+                    index.displacements[bucketIndex] = d;
+                    for (size_t j = 0; j < bucket.size(); j++) {
+                        index.slots[bucketSlots[j]] = bucket[j];
+                    }
+                }
+            }
+
+            if (!placed) {
+                success = false;
+                break;
+            }
+        }
+
+        if (success) {
+            return index;
+        }
+    }
+}
+
+// Cache of decoded values, keyed by index. Values are evicted, least recently
+// used first, once their total weight exceeds the limit. The value returned
+// last is never evicted. Values are shared with callers, who keep them alive
+// after eviction for as long as they hold them.
+template <class Value>
+class LruCache {
+public:
+    using Weigh = size_t(*)(const Value&);
+
+    LruCache(size_t limit, Weigh weigh)
+        : _limit(limit)
+        , _weigh(weigh)
+    { }
+
+    template <std::invocable Load>
+    std::shared_ptr<const Value> get(uint32_t index, Load&& load)
+    {
+        auto lock = std::lock_guard{_mutex};
+
+        if (auto it = _entries.find(index); it != _entries.end()) {
+            _lru.splice(_lru.begin(), _lru, it->second.lruPosition);
+            return it->second.value;
+        }
+
+        auto value = std::make_shared<const Value>(std::forward<Load>(load)());
+        _lru.push_front(index);
+        auto& entry = _entries[index];
+        entry.value = std::move(value);
+        entry.lruPosition = _lru.begin();
+        _weight += _weigh(*entry.value);
+
+        while (_weight > _limit && _lru.size() > 1) {
+            auto evicted = _entries.find(_lru.back());
+            _weight -= _weigh(*evicted->second.value);
+            _entries.erase(evicted);
+            _lru.pop_back();
+        }
+
+        return entry.value;
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<const Value> value;
+        std::list<uint32_t>::iterator lruPosition;
+    };
+
+    std::mutex _mutex;
+    size_t _limit = 0;
+    Weigh _weigh = nullptr;
+    size_t _weight = 0;
+    std::list<uint32_t> _lru;
+    std::unordered_map<uint32_t, Entry> _entries;
+};
+
+void writeVarint(std::string& output, uint32_t value)
+{
+    while (value >= 0x80) {
+        output.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    output.push_back(static_cast<char>(value));
+}
+
+uint32_t readVarint(std::string_view input, size_t& position)
+{
+    uint32_t value = 0;
+    for (int shift = 0; ; shift += 7) {
+        if (position >= input.size() || shift > 28) {
+            throw Error{} << "malformed varint in front coded strings";
+        }
+        const auto byte = static_cast<unsigned char>(input[position++]);
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+}
+
+constexpr uint32_t frontCodingBlockSize = 16;
+// Bytes of front coded strings kept decoded per table
+constexpr size_t decodedStringsLimit = 1024 * 1024;
+
 template <class FbObject>
 requires
     std::same_as<FbObject, fb::Strings> ||
@@ -20,9 +226,36 @@ std::tuple<uint32_t, uint32_t> calculateRange(
 
 } // namespace
 
+static_assert(std::random_access_iterator<IndexIterator<Strings>>);
+static_assert(std::ranges::random_access_range<Strings>);
+static_assert(std::ranges::random_access_range<BinaryData>);
+static_assert(std::ranges::random_access_range<NamedDataStorage>);
+
+class Strings::Cache : public LruCache<std::string> {
+public:
+    Cache()
+        : LruCache(decodedStringsLimit, [] (const std::string& string) {
+            return string.size();
+        })
+    { }
+};
+
+class BinaryData::Cache : public LruCache<std::vector<std::byte>> {
+public:
+    explicit Cache(size_t limit)
+        : LruCache(limit, [] (const std::vector<std::byte>& data) {
+            return data.size();
+        })
+    { }
+};
+
 Strings::Strings(const fb::Strings* fbStrings)
     : _fbStrings(fbStrings)
-{ }
+{
+    if (_fbStrings->encoding() == fb::StringsEncoding::FrontCoded) {
+        _cache = std::make_shared<Cache>();
+    }
+}
 
 IndexIterator<Strings> Strings::begin() const
 {
@@ -31,38 +264,296 @@ IndexIterator<Strings> Strings::begin() const
 
 IndexIterator<Strings> Strings::end() const
 {
-    return {*this, _fbStrings->offsets()->size()};
+    return {*this, (uint32_t)size()};
 }
 
 std::string_view Strings::operator[](uint32_t index) const
 {
-    auto [begin, end] = calculateRange(_fbStrings, index);
-    return _fbStrings->data()->string_view().substr(begin, end - begin);
+    switch (_fbStrings->encoding()) {
+        case fb::StringsEncoding::Plain:
+        {
+            auto [begin, end] = calculateRange(_fbStrings, index);
+            return _fbStrings->data()->string_view().substr(begin, end - begin);
+        }
+        case fb::StringsEncoding::Interned:
+            return _fbStrings->data()->string_view().substr(
+                _fbStrings->offsets()->Get(index),
+                _fbStrings->lengths()->Get(index));
+        case fb::StringsEncoding::FrontCoded:
+        {
+            const auto entry = _fbStrings->entries()->Get(index);
+            // The view outlives the returned pointer, as the cache keeps the
+            // string until it is evicted
+            return *_cache->get(entry, [this, entry] {
+                return decodeEntry(entry);
+            });
+        }
+    }
+
+    throw Error{} << "unknown strings encoding: " <<
+        static_cast<int>(_fbStrings->encoding());
 }
 
 size_t Strings::size() const
 {
+    if (_fbStrings->encoding() == fb::StringsEncoding::FrontCoded) {
+        return _fbStrings->entries()->size();
+    }
     return _fbStrings->offsets()->size();
 }
 
+std::string Strings::decodeEntry(uint32_t entry) const
+{
+    const auto data = _fbStrings->data()->string_view();
+    size_t position =
+        _fbStrings->blockOffsets()->Get(entry / frontCodingBlockSize);
+
+    auto string = std::string{};
+    for (uint32_t i = 0; i <= entry % frontCodingBlockSize; i++) {
+        const uint32_t shared = i == 0 ? 0 : readVarint(data, position);
+        const uint32_t suffixSize = readVarint(data, position);
+        if (shared > string.size() || suffixSize > data.size() - position) {
+            throw Error{} << "malformed front coded string " << entry;
+        }
+        string.resize(shared);
+        string.append(data.substr(position, suffixSize));
+        position += suffixSize;
+    }
+    return string;
+}
+
+std::optional<uint32_t> Strings::find(std::string_view string) const
+{
+    if (const auto* index = _fbStrings->nameIndex()) {
+        if (index->slots()->size() == 0) {
+            return std::nullopt;
+        }
+        const auto h = hash(string, index->seed());
+        const auto displacement =
+            index->displacements()->Get(h % index->displacements()->size());
+        const auto i =
+            index->slots()->Get(slot(h, displacement, index->slots()->size()));
+        if ((*this)[i] == string) {
+            return i;
+        }
+        return std::nullopt;
+    }
+
+    for (uint32_t i = 0; i < size(); i++) {
+        if ((*this)[i] == string) {
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
+void validate(const fb::Strings* fbStrings)
+{
+    const size_t dataSize = fbStrings->data() ? fbStrings->data()->size() : 0;
+    auto require = [] (const auto* vector, std::string_view name) {
+        if (!vector) {
+            throw Error{} << "strings table has no " << name;
+        }
+        return vector;
+    };
+
+    size_t count = 0;
+    switch (fbStrings->encoding()) {
+        case fb::StringsEncoding::Plain:
+        {
+            const auto* offsets = require(fbStrings->offsets(), "offsets");
+            count = offsets->size();
+            uint32_t previous = 0;
+            for (uint32_t offset : *offsets) {
+                if (offset < previous || offset > dataSize) {
+                    throw Error{} << "string offset " << offset <<
+                        " is out of order or outside " << dataSize << " bytes";
+                }
+                previous = offset;
+            }
+            break;
+        }
+        case fb::StringsEncoding::Interned:
+        {
+            const auto* offsets = require(fbStrings->offsets(), "offsets");
+            const auto* lengths = require(fbStrings->lengths(), "lengths");
+            count = offsets->size();
+            if (lengths->size() != count) {
+                throw Error{} << "strings table has " << count <<
+                    " offsets but " << lengths->size() << " lengths";
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                if (offsets->Get(i) > dataSize ||
+                        lengths->Get(i) > dataSize - offsets->Get(i)) {
+                    throw Error{} << "string " << i << " is outside " <<
+                        dataSize << " bytes";
+                }
+            }
+            break;
+        }
+        case fb::StringsEncoding::FrontCoded:
+        {
+            const auto* blockOffsets =
+                require(fbStrings->blockOffsets(), "block offsets");
+            const auto* entries = require(fbStrings->entries(), "entries");
+            count = entries->size();
+            for (uint32_t blockOffset : *blockOffsets) {
+                if (blockOffset > dataSize) {
+                    throw Error{} << "string block offset " << blockOffset <<
+                        " is outside " << dataSize << " bytes";
+                }
+            }
+            // Strings within a block are checked as they are decoded
+            const size_t uniqueLimit =
+                size_t{blockOffsets->size()} * frontCodingBlockSize;
+            for (uint32_t entry : *entries) {
+                if (entry >= uniqueLimit) {
+                    throw Error{} << "string entry " << entry <<
+                        " is outside " << blockOffsets->size() << " blocks";
+                }
+            }
+            break;
+        }
+        default:
+            throw Error{} << "unknown strings encoding: " <<
+                static_cast<int>(fbStrings->encoding());
+    }
+    if (count > 0 && !fbStrings->data()) {
+        throw Error{} << "strings table has " << count << " strings but no data";
+    }
+
+    if (const auto* index = fbStrings->nameIndex()) {
+        const auto* slots = require(index->slots(), "name index slots");
+        if (slots->size() > 0 &&
+                require(index->displacements(), "name index displacements")
+                    ->size() == 0) {
+            throw Error{} << "name index has slots but no displacements";
+        }
+        for (uint32_t slot : *slots) {
+            if (slot >= count) {
+                throw Error{} << "name index slot " << slot << " is outside " <<
+                    count << " strings";
+            }
+        }
+    }
+}
+
 flatbuffers::Offset<fb::Strings> pack(
     flatbuffers::FlatBufferBuilder& builder,
-    const std::vector<std::string>& strings)
+    const std::vector<std::string>& strings,
+    const StringsPackOptions& options)
 {
     auto data = std::string{};
     auto offsets = std::vector<uint32_t>{};
-    for (const auto& string : strings) {
-        offsets.push_back((uint32_t)data.length());
-        data += string;
+    auto lengths = std::vector<uint32_t>{};
+    auto blockOffsets = std::vector<uint32_t>{};
+    auto entries = std::vector<uint32_t>{};
+    switch (options.encoding) {
+        case fb::StringsEncoding::Plain:
+        {
+            for (const auto& string : strings) {
+                offsets.push_back((uint32_t)data.length());
+                data += string;
+            }
+            break;
+        }
+        case fb::StringsEncoding::Interned:
+        {
+            auto offsetByString = std::unordered_map<std::string_view, uint32_t>{};
+            for (const auto& string : strings) {
+                auto [it, inserted] =
+                    offsetByString.emplace(string, (uint32_t)data.length());
+                if (inserted) {
+                    data += string;
+                }
+                offsets.push_back(it->second);
+                lengths.push_back((uint32_t)string.length());
+            }
+            break;
+        }
+        case fb::StringsEncoding::FrontCoded:
+        {
+            auto unique = std::vector<std::string_view>(
+                strings.begin(), strings.end());
+            std::ranges::sort(unique);
+            auto [first, last] = std::ranges::unique(unique);
+            unique.erase(first, last);
+
+            for (const auto& string : strings) {
+                entries.push_back((uint32_t)(
+                    std::ranges::lower_bound(unique, string) - unique.begin()));
+            }
+
+            for (size_t i = 0; i < unique.size(); i++) {
+                if (i % frontCodingBlockSize == 0) {
+                    blockOffsets.push_back((uint32_t)data.length());
+                    writeVarint(data, (uint32_t)unique[i].size());
+                    data += unique[i];
+                } else {
+                    const auto [mismatch, _] = std::ranges::mismatch(
+                        unique[i - 1], unique[i]);
+                    const auto shared =
+                        (uint32_t)(mismatch - unique[i - 1].begin());
+                    writeVarint(data, shared);
+                    writeVarint(data, (uint32_t)unique[i].size() - shared);
+                    data += unique[i].substr(shared);
+                }
+            }
+            break;
+        }
+    }
+
+    auto nameIndex = flatbuffers::Offset<fb::NameIndex>{};
+    if (options.nameIndex) {
+        auto index = buildNameIndex(strings);
+        nameIndex = fb::CreateNameIndex(
+            builder,
+            index.seed,
+            builder.CreateVector(index.displacements),
+            builder.CreateVector(index.slots));
+    }
+
+    auto offsetsOffset = flatbuffers::Offset<flatbuffers::Vector<uint32_t>>{};
+    if (options.encoding != fb::StringsEncoding::FrontCoded) {
+        offsetsOffset = builder.CreateVector(offsets);
+    }
+    auto lengthsOffset = flatbuffers::Offset<flatbuffers::Vector<uint32_t>>{};
+    if (options.encoding == fb::StringsEncoding::Interned) {
+        lengthsOffset = builder.CreateVector(lengths);
+    }
+    auto blockOffsetsOffset = flatbuffers::Offset<flatbuffers::Vector<uint32_t>>{};
+    auto entriesOffset = flatbuffers::Offset<flatbuffers::Vector<uint32_t>>{};
+    if (options.encoding == fb::StringsEncoding::FrontCoded) {
+        blockOffsetsOffset = builder.CreateVector(blockOffsets);
+        entriesOffset = builder.CreateVector(entries);
     }
 
     return fb::CreateStrings(
-        builder, builder.CreateString(data), builder.CreateVector(offsets));
+        builder,
+        builder.CreateString(data),
+        offsetsOffset,
+        nameIndex,
+        options.encoding,
+        lengthsOffset,
+        blockOffsetsOffset,
+        entriesOffset);
 }
 
-BinaryData::BinaryData(const fb::BinaryData* fbBinaryData)
+BinaryData::BinaryData(
+    const fb::BinaryData* fbBinaryData,
+    std::span<const std::byte> buffer,
+    const BinaryDataOptions& options)
     : _fbBinaryData(fbBinaryData)
-{ }
+    , _buffer(buffer)
+{
+    if (_fbBinaryData->codecs() && _fbBinaryData->codecs()->size() > 0) {
+        _cache = std::make_shared<Cache>(options.cacheLimit);
+    }
+    if (options.verifyChecksums && _fbBinaryData->checksums()) {
+        _verified = std::shared_ptr<std::atomic<bool>[]>(
+            new std::atomic<bool>[size()]());
+    }
+}
 
 [[nodiscard]] IndexIterator<BinaryData> BinaryData::begin() const
 {
@@ -71,42 +562,320 @@ BinaryData::BinaryData(const fb::BinaryData* fbBinaryData)
 
 [[nodiscard]] IndexIterator<BinaryData> BinaryData::end() const
 {
-    return {*this, _fbBinaryData->offsets()->size()};
+    return {*this, (uint32_t)size()};
+}
+
+Blob BinaryData::operator[](uint32_t index) const
+{
+    const auto blobCodec = codec(index);
+    if (blobCodec == fb::Codec::None) {
+        return Blob{stored(index)};
+    }
+
+    return Blob{_cache->get(index, [this, index, blobCodec] {
+        return decompress(
+            blobCodec, stored(index), _fbBinaryData->sizes()->Get(index));
+    })};
+}
+
+size_t BinaryData::size() const
+{
+    if (const auto* externalOffsets = _fbBinaryData->externalOffsets()) {
+        return externalOffsets->size();
+    }
+    return _fbBinaryData->offsets()->size();
+}
+
+fb::Codec BinaryData::codec(uint32_t index) const
+{
+    if (!_cache) {
+        return fb::Codec::None;
+    }
+    return _fbBinaryData->codecs()->Get(index);
 }
 
-std::span<const std::byte> BinaryData::operator[](uint32_t index) const
+size_t BinaryData::alignment() const
 {
+    return _fbBinaryData->alignment();
+}
+
+std::span<const std::byte> BinaryData::stored(uint32_t index) const
+{
+    if (const auto* externalOffsets = _fbBinaryData->externalOffsets()) {
+        const uint64_t begin = externalOffsets->Get(index);
+        const uint64_t size = _fbBinaryData->storedSizes()->Get(index);
+        if (begin > _buffer.size() || size > _buffer.size() - begin) {
+            throw Error{} << "streamed blob " << index <<
+                " is outside of the buffer of " << _buffer.size() << " bytes";
+        }
+        auto blob = _buffer.subspan(begin, size);
+        verify(index, blob);
+        return blob;
+    }
+
     auto [begin, end] = calculateRange(_fbBinaryData, index);
+    if (const auto* storedSizes = _fbBinaryData->storedSizes()) {
+        end = begin + storedSizes->Get(index);
+    }
     const auto* ptr =
         reinterpret_cast<const std::byte*>(_fbBinaryData->data()->data() + begin);
-    return {ptr, end - begin};
+    auto blob = std::span<const std::byte>{ptr, end - begin};
+    verify(index, blob);
+    return blob;
 }
 
-size_t BinaryData::size() const
+BlobRange BinaryData::storedRange(uint32_t index) const
 {
-    return _fbBinaryData->offsets()->size();
+    if (const auto* externalOffsets = _fbBinaryData->externalOffsets()) {
+        return {
+            .offset = externalOffsets->Get(index),
+            .size = _fbBinaryData->storedSizes()->Get(index),
+        };
+    }
+
+    if (_buffer.empty()) {
+        throw Error{} << "no stored range for blob " << index <<
+            ": the table was loaded without its buffer";
+    }
+    auto [begin, end] = calculateRange(_fbBinaryData, index);
+    if (const auto* storedSizes = _fbBinaryData->storedSizes()) {
+        end = begin + storedSizes->Get(index);
+    }
+    const auto* data =
+        reinterpret_cast<const std::byte*>(_fbBinaryData->data()->data());
+    return {
+        .offset = static_cast<uint64_t>(data - _buffer.data()) + begin,
+        .size = end - begin,
+    };
+}
+
+std::vector<std::byte> BinaryData::decode(
+    uint32_t index, std::vector<std::byte> stored) const
+{
+    verify(index, stored);
+    const auto blobCodec = codec(index);
+    if (blobCodec == fb::Codec::None) {
+        return stored;
+    }
+    return decompress(blobCodec, stored, _fbBinaryData->sizes()->Get(index));
+}
+
+void BinaryData::verify(uint32_t index, std::span<const std::byte> blob) const
+{
+    if (!_verified || _verified[index].load(std::memory_order_acquire)) {
+        return;
+    }
+
+    const uint32_t expected = _fbBinaryData->checksums()->Get(index);
+    const uint32_t actual = crc32c(blob);
+    if (actual != expected) {
+        throw Error{} << "checksum mismatch in blob " << index <<
+            ": expected " << expected << ", got " << actual;
+    }
+    _verified[index].store(true, std::memory_order_release);
+}
+
+void validate(
+    const fb::BinaryData* fbBinaryData, std::span<const std::byte> buffer)
+{
+    const auto* externalOffsets = fbBinaryData->externalOffsets();
+    const auto* offsets = fbBinaryData->offsets();
+    if (!externalOffsets && !offsets) {
+        throw Error{} << "binary data table has no offsets";
+    }
+    const size_t count = externalOffsets ? externalOffsets->size() : offsets->size();
+
+    auto checkSize = [count] (const auto* vector, std::string_view name) {
+        if (vector && vector->size() != count) {
+            throw Error{} << "binary data table has " << count << " blobs but " <<
+                vector->size() << " " << name;
+        }
+    };
+    const auto* storedSizes = fbBinaryData->storedSizes();
+    checkSize(storedSizes, "stored sizes");
+    checkSize(fbBinaryData->checksums(), "checksums");
+    const auto* codecs = fbBinaryData->codecs();
+    if (codecs && codecs->size() > 0) {
+        checkSize(codecs, "codecs");
+        checkSize(fbBinaryData->sizes(), "sizes");
+        if (!fbBinaryData->sizes()) {
+            throw Error{} << "binary data table has codecs but no sizes";
+        }
+    }
+
+    if (externalOffsets) {
+        if (!storedSizes) {
+            throw Error{} << "streamed binary data table has no stored sizes";
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            const uint64_t begin = externalOffsets->Get(i);
+            const uint64_t size = storedSizes->Get(i);
+            if (begin > buffer.size() || size > buffer.size() - begin) {
+                throw Error{} << "streamed blob " << i <<
+                    " is outside of the buffer of " << buffer.size() << " bytes";
+            }
+        }
+        return;
+    }
+
+    if (count > 0 && !fbBinaryData->data()) {
+        throw Error{} << "binary data table has offsets but no data";
+    }
+    const uint64_t dataSize = count > 0 ? fbBinaryData->data()->size() : 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const auto [begin, rangeEnd] = calculateRange(fbBinaryData, i);
+        const uint64_t end =
+            storedSizes ? uint64_t{begin} + storedSizes->Get(i) : rangeEnd;
+        if (begin > end || end > dataSize) {
+            throw Error{} << "blob " << i << " is outside " << dataSize <<
+                " bytes of data";
+        }
+    }
 }
 
 flatbuffers::Offset<fb::BinaryData> pack(
     flatbuffers::FlatBufferBuilder& builder,
-    const std::vector<std::vector<std::byte>>& blobs)
+    const std::vector<std::vector<std::byte>>& blobs,
+    const BinaryDataPackOptions& options,
+    PackReport* report)
 {
+    if (options.alignment == 0 ||
+            (options.alignment & (options.alignment - 1)) != 0) {
+        throw Error{} << "blob alignment must be a power of two, got " <<
+            options.alignment;
+    }
+    // The builder aligns vectors to at most this; packStreaming places blobs
+    // itself, and takes any alignment
+    if (options.alignment > FLATBUFFERS_MAX_ALIGNMENT) {
+        throw Error{} << "blob alignment of " << options.alignment <<
+            " bytes is above the " << FLATBUFFERS_MAX_ALIGNMENT <<
+            " bytes supported when packing in memory; use packStreaming";
+    }
+    const bool aligned = options.alignment > 1;
+
     auto data = std::vector<uint8_t>{};
     auto offsets = std::vector<uint32_t>{};
-    for (const auto& blob : blobs) {
+    auto codecs = std::vector<fb::Codec>{};
+    auto sizes = std::vector<uint32_t>{};
+    auto storedSizes = std::vector<uint32_t>{};
+    auto checksums = std::vector<uint32_t>{};
+    bool anyCompressed = false;
+    auto localReport = PackReport{};
+    auto blobIndicesByHash = std::unordered_map<uint64_t, std::vector<size_t>>{};
+
+    auto append = [&] (std::span<const std::byte> bytes) {
+        data.resize(
+            (data.size() + options.alignment - 1) & ~(options.alignment - 1));
         offsets.push_back((uint32_t)data.size());
-        for (std::byte b : blob) {
-            data.push_back(static_cast<uint8_t>(b));
+        storedSizes.push_back((uint32_t)bytes.size());
+        checksums.push_back(crc32c(bytes));
+        const auto* begin = reinterpret_cast<const uint8_t*>(bytes.data());
+        data.insert(data.end(), begin, begin + bytes.size());
+    };
+
+    for (size_t i = 0; i < blobs.size(); i++) {
+        const auto& blob = blobs.at(i);
+        localReport.blobCount++;
+        sizes.push_back((uint32_t)blob.size());
+
+        if (options.deduplicate) {
+            auto& candidates = blobIndicesByHash[hash64(blob)];
+            auto original = std::ranges::find_if(
+                candidates, [&] (size_t j) { return blobs.at(j) == blob; });
+            if (original != candidates.end()) {
+                offsets.push_back(offsets.at(*original));
+                storedSizes.push_back(storedSizes.at(*original));
+                checksums.push_back(checksums.at(*original));
+                codecs.push_back(codecs.at(*original));
+                localReport.duplicateCount++;
+                localReport.savedBytes += storedSizes.back();
+                continue;
+            }
+            candidates.push_back(i);
+        }
+
+        bool compressed = false;
+        if (options.codec != fb::Codec::None) {
+            auto compressedBlob = compress(options.codec, blob);
+            if (compressedBlob.size() < blob.size()) {
+                append(compressedBlob);
+                codecs.push_back(options.codec);
+                anyCompressed = true;
+                compressed = true;
+            }
+        }
+
+        if (!compressed) {
+            append(blob);
+            codecs.push_back(fb::Codec::None);
         }
+        localReport.storedBytes += storedSizes.back();
+    }
+
+    if (report) {
+        *report += localReport;
+    }
+
+    if (aligned) {
+        builder.ForceVectorAlignment(
+            data.size(), sizeof(uint8_t), options.alignment);
+    }
+    auto dataOffset = builder.CreateVector(data);
+    auto offsetsOffset = builder.CreateVector(offsets);
+
+    auto codecsOffset = flatbuffers::Offset<flatbuffers::Vector<fb::Codec>>{};
+    auto sizesOffset = flatbuffers::Offset<flatbuffers::Vector<uint32_t>>{};
+    if (anyCompressed) {
+        codecsOffset = builder.CreateVector(codecs);
+        sizesOffset = builder.CreateVector(sizes);
     }
 
+    // Sizes can only be derived from offsets of adjacent blobs if there is no
+    // padding, and no blobs are shared.
+    auto storedSizesOffset = flatbuffers::Offset<flatbuffers::Vector<uint32_t>>{};
+    if (aligned || localReport.duplicateCount > 0) {
+        storedSizesOffset = builder.CreateVector(storedSizes);
+    }
+
+    auto checksumsOffset = builder.CreateVector(checksums);
+
     return fb::CreateBinaryData(
-        builder, builder.CreateVector(data), builder.CreateVector(offsets));
+        builder,
+        dataOffset,
+        offsetsOffset,
+        codecsOffset,
+        sizesOffset,
+        storedSizesOffset,
+        (uint32_t)options.alignment,
+        0,
+        checksumsOffset);
+}
+
+PackReport& PackReport::operator+=(const PackReport& other)
+{
+    blobCount += other.blobCount;
+    duplicateCount += other.duplicateCount;
+    storedBytes += other.storedBytes;
+    savedBytes += other.savedBytes;
+    return *this;
 }
 
-NamedDataStorage::NamedDataStorage(const fb::Strings* names, const fb::BinaryData* data)
+std::ostream& operator<<(std::ostream& output, const PackReport& report)
+{
+    return output <<
+        report.blobCount << " blobs, " <<
+        Size{report.storedBytes} << " stored; " <<
+        report.duplicateCount << " duplicates, " <<
+        Size{report.savedBytes} << " saved";
+}
+
+NamedDataStorage::NamedDataStorage(
+    const fb::Strings* names,
+    const fb::BinaryData* data,
+    std::span<const std::byte> buffer,
+    const BinaryDataOptions& options)
     : _names(names)
-    , _data(data)
+    , _data(data, buffer, options)
 { }
 
 [[nodiscard]] IndexIterator<NamedDataStorage> NamedDataStorage::begin() const
@@ -116,21 +885,26 @@ NamedDataStorage::NamedDataStorage(const fb::Strings* names, const fb::BinaryDat
 
 [[nodiscard]] IndexIterator<NamedDataStorage> NamedDataStorage::end() const
 {
-    return {*this, _names->offsets()->size()};
+    return {*this, (uint32_t)_names.size()};
 }
 
 NamedData NamedDataStorage::operator[](uint32_t index) const
 {
     auto result = NamedData {
-        .name = Strings{_names}[index],
-        .data = BinaryData{_data}[index],
+        .name = _names[index],
+        .data = _data[index],
     };
     return result;
 }
 
 size_t NamedDataStorage::size() const
 {
-    return _names->offsets()->size();
+    return _names.size();
+}
+
+std::optional<uint32_t> NamedDataStorage::find(std::string_view name) const
+{
+    return _names.find(name);
 }
 
 } // namespace data
@@ -2,22 +2,68 @@
 
 #include "data_generated.h"
 
+#include "error.hpp"
+
+#include <atomic>
+#include <compare>
 #include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <ranges>
 #include <span>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace data {
 
+// Random-access iterator over any container exposing operator[](uint32_t) and
+// size(). Dereferencing returns the container's element by value (a proxy, such
+// as std::string_view or std::span), so the iterator is cheap to copy and can
+// be used with both std::ranges and the classic (including parallel)
+// algorithms.
 template <class Container>
 class IndexIterator {
 public:
+    // Classic algorithms only look at iterator_category, and happily accept
+    // proxy references. Ranges use iterator_concept.
+    using iterator_category = std::random_access_iterator_tag;
+    using iterator_concept = std::random_access_iterator_tag;
+    using value_type = std::remove_cvref_t<
+        decltype(std::declval<const Container&>()[uint32_t{}])>;
+    using difference_type = std::ptrdiff_t;
+    using reference = value_type;
+    using pointer = void;
+
+    IndexIterator() = default;
+
     IndexIterator(const Container& container, uint32_t index)
-        : _container(container)
+        : _container(&container)
         , _index(index)
     { }
 
+    [[nodiscard]] uint32_t index() const
+    {
+        return _index;
+    }
+
+    reference operator*() const
+    {
+        return (*_container)[_index];
+    }
+
+    reference operator[](difference_type n) const
+    {
+        return *(*this + n);
+    }
+
     IndexIterator& operator++()
     {
         ++_index;
@@ -31,9 +77,50 @@ public:
         return temp;
     }
 
-    auto operator*() const
+    IndexIterator& operator--()
+    {
+        --_index;
+        return *this;
+    }
+
+    IndexIterator operator--(int)
+    {
+        auto temp = *this;
+        --*this;
+        return temp;
+    }
+
+    IndexIterator& operator+=(difference_type n)
+    {
+        _index = static_cast<uint32_t>(static_cast<difference_type>(_index) + n);
+        return *this;
+    }
+
+    IndexIterator& operator-=(difference_type n)
     {
-        return _container[_index];
+        return *this += -n;
+    }
+
+    friend IndexIterator operator+(IndexIterator it, difference_type n)
+    {
+        return it += n;
+    }
+
+    friend IndexIterator operator+(difference_type n, IndexIterator it)
+    {
+        return it += n;
+    }
+
+    friend IndexIterator operator-(IndexIterator it, difference_type n)
+    {
+        return it -= n;
+    }
+
+    friend difference_type operator-(
+        const IndexIterator& lhs, const IndexIterator& rhs)
+    {
+        return static_cast<difference_type>(lhs._index) -
+            static_cast<difference_type>(rhs._index);
     }
 
     friend bool operator==(const IndexIterator& lhs, const IndexIterator& rhs)
@@ -41,19 +128,58 @@ public:
         return lhs._index == rhs._index;
     }
 
-    friend bool operator!=(const IndexIterator& lhs, const IndexIterator& rhs)
+    friend std::strong_ordering operator<=>(
+        const IndexIterator& lhs, const IndexIterator& rhs)
     {
-        return !(lhs == rhs);
+        return lhs._index <=> rhs._index;
+    }
+
+    // An iterator also compares against std::default_sentinel, which stands
+    // for the end of the container it was created from.
+    friend bool operator==(const IndexIterator& it, std::default_sentinel_t)
+    {
+        return it._index >= it._container->size();
+    }
+
+    friend difference_type operator-(
+        std::default_sentinel_t, const IndexIterator& it)
+    {
+        return static_cast<difference_type>(it._container->size()) -
+            static_cast<difference_type>(it._index);
+    }
+
+    friend difference_type operator-(
+        const IndexIterator& it, std::default_sentinel_t sentinel)
+    {
+        return -(sentinel - it);
     }
 
 private:
-    const Container& _container;
+    const Container* _container = nullptr;
     uint32_t _index = 0;
 };
 
+template <class Container>
+using IndexRange = std::ranges::subrange<IndexIterator<Container>>;
+
+// Elements [first, last) of the container, without touching any of them.
+template <class Container>
+IndexRange<Container> slice(
+    const Container& container, uint32_t first, uint32_t last)
+{
+    return {
+        IndexIterator<Container>{container, first},
+        IndexIterator<Container>{container, last}};
+}
+
+// Front coded strings are decoded on access into a cache of recently used
+// strings, shared by copies of the Strings object and bounded to 1 MiB. A view
+// of a front coded string stays valid until that many bytes of other strings
+// have been decoded since it was last accessed, so callers that keep a string
+// for longer copy it.
 class Strings {
 public:
-    Strings(const fb::Strings* fbStrings);
+    explicit Strings(const fb::Strings* fbStrings);
 
     [[nodiscard]] IndexIterator<Strings> begin() const;
     [[nodiscard]] IndexIterator<Strings> end() const;
@@ -61,40 +187,250 @@ public:
     std::string_view operator[](uint32_t index) const;
     [[nodiscard]] size_t size() const;
 
+    // Index of the given string. Uses the packed name index if there is one,
+    // and falls back to a linear search otherwise.
+    [[nodiscard]] std::optional<uint32_t> find(std::string_view string) const;
+
 private:
+    class Cache;
+
+    [[nodiscard]] std::string decodeEntry(uint32_t entry) const;
+
     const fb::Strings* _fbStrings = nullptr;
+    std::shared_ptr<Cache> _cache;
+};
+
+struct StringsPackOptions {
+    // Build a perfect hash index, so that Strings::find is O(1). All strings
+    // must be unique.
+    bool nameIndex = false;
+
+    fb::StringsEncoding encoding = fb::StringsEncoding::Plain;
 };
 
 flatbuffers::Offset<fb::Strings> pack(
     flatbuffers::FlatBufferBuilder& builder,
-    const std::vector<std::string>& strings);
+    const std::vector<std::string>& strings,
+    const StringsPackOptions& options = {});
+
+// Check that every string of a table that passed flatbuffers::Verifier lies
+// within its data, so that Strings can read it without further checks. Throws
+// on the first violation.
+void validate(const fb::Strings* fbStrings);
+
+struct BinaryDataOptions {
+    size_t cacheLimit = 64 * 1024 * 1024;
+
+    // Check every blob against its packed checksum, if there is one, the first
+    // time it is accessed.
+    bool verifyChecksums = true;
+};
+
+// Where a blob is stored in the buffer a table was loaded from, which is the
+// whole file for tables in a packed file
+struct BlobRange {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+};
 
+// Bytes of a blob. An uncompressed blob points into the buffer its table was
+// loaded from, which must outlive it. A decompressed blob shares ownership of
+// its bytes with the cache, so that it stays valid after being evicted. Spans
+// taken from a Blob are only valid for as long as it is kept.
+class Blob {
+public:
+    Blob() = default;
+
+    explicit Blob(std::span<const std::byte> bytes)
+        : _bytes(bytes)
+    { }
+
+    explicit Blob(std::shared_ptr<const std::vector<std::byte>> owner)
+        : _owner(std::move(owner))
+        , _bytes(*_owner)
+    { }
+
+    [[nodiscard]] const std::byte* data() const { return _bytes.data(); }
+    [[nodiscard]] size_t size() const { return _bytes.size(); }
+    [[nodiscard]] bool empty() const { return _bytes.empty(); }
+    [[nodiscard]] auto begin() const { return _bytes.begin(); }
+    [[nodiscard]] auto end() const { return _bytes.end(); }
+
+private:
+    std::shared_ptr<const std::vector<std::byte>> _owner;
+    std::span<const std::byte> _bytes;
+};
+
+// Uncompressed blobs are returned directly from the underlying buffer. Streamed
+// blobs are located through the buffer the table was loaded from, which must
+// then be passed to the constructor.
+//
+// Compressed blobs are decompressed on first access, and kept in a cache shared
+// by all copies of the BinaryData object. Once the cache grows over its limit,
+// least recently used blobs are evicted from it; Blobs returned for them keep
+// their bytes alive until they are destroyed.
 class BinaryData {
 public:
-    BinaryData(const fb::BinaryData* fbBinaryData);
+    BinaryData(
+        const fb::BinaryData* fbBinaryData,
+        std::span<const std::byte> buffer = {},
+        const BinaryDataOptions& options = {});
 
     [[nodiscard]] IndexIterator<BinaryData> begin() const;
     [[nodiscard]] IndexIterator<BinaryData> end() const;
 
-    std::span<const std::byte> operator[](uint32_t index) const;
+    Blob operator[](uint32_t index) const;
     [[nodiscard]] size_t size() const;
 
+    [[nodiscard]] fb::Codec codec(uint32_t index) const;
+
+    // Range of a blob as stored, compressed or not, for reading it from the
+    // file without touching the buffer, such as with AsyncReader. Throws if
+    // the table was loaded without its buffer.
+    [[nodiscard]] BlobRange storedRange(uint32_t index) const;
+    // Blob from the bytes read from its stored range: checked against its
+    // checksum, and decompressed if needed. The cache is not involved.
+    [[nodiscard]] std::vector<std::byte> decode(
+        uint32_t index, std::vector<std::byte> stored) const;
+
+    // Alignment of every uncompressed blob, as requested at pack time.
+    // Decompressed blobs are only aligned to alignof(std::max_align_t).
+    [[nodiscard]] size_t alignment() const;
+
+    // Uncompressed blob viewed as an array of T. Throws if the blob is
+    // compressed, as nothing would keep its bytes alive, if it is not suitably
+    // aligned, or if its size is not a multiple of sizeof(T).
+    template <class T>
+    requires std::is_trivially_copyable_v<T>
+    std::span<const T> as(uint32_t index) const
+    {
+        if (codec(index) != fb::Codec::None) {
+            throw Error{} << "blob " << index << " is compressed";
+        }
+        auto bytes = stored(index);
+        if (reinterpret_cast<uintptr_t>(bytes.data()) % alignof(T) != 0) {
+            throw Error{} << "blob " << index << " is not aligned to " <<
+                alignof(T) << " bytes";
+        }
+        if (bytes.size() % sizeof(T) != 0) {
+            throw Error{} << "blob " << index << " of " << bytes.size() <<
+                " bytes is not an array of " << sizeof(T) << "-byte elements";
+        }
+        return {
+            reinterpret_cast<const T*>(bytes.data()), bytes.size() / sizeof(T)};
+    }
+
 private:
+    class Cache;
+
+    [[nodiscard]] std::span<const std::byte> stored(uint32_t index) const;
+    void verify(uint32_t index, std::span<const std::byte> blob) const;
+
     const fb::BinaryData* _fbBinaryData = nullptr;
+    std::span<const std::byte> _buffer;
+    std::shared_ptr<Cache> _cache;
+    std::shared_ptr<std::atomic<bool>[]> _verified;
+};
+
+struct BinaryDataPackOptions {
+    // Compress blobs with this codec. A blob is stored uncompressed if
+    // compression does not make it smaller.
+    fb::Codec codec = fb::Codec::None;
+
+    // Start every blob at a multiple of this many bytes in the packed file,
+    // e.g. 64 for SIMD-friendly access, or 4096 for page-granular blobs. Must
+    // be a power of two. Packing in memory supports alignments up to
+    // FLATBUFFERS_MAX_ALIGNMENT; packStreaming supports any.
+    size_t alignment = 1;
+
+    // Store blobs with identical contents once, and point all their entries
+    // to the same data.
+    bool deduplicate = true;
+
+    // packStreaming only: read, hash and compress input files on this many
+    // threads (0 for one per hardware thread), keeping at most
+    // ingestMemoryLimit bytes of them loaded ahead of the output.
+    size_t ingestThreads = 0;
+    size_t ingestMemoryLimit = 256 * 1024 * 1024;
+
+    // packStreaming only: keep compressed blobs, and the layout of the output,
+    // in this directory. If only the flatbuffer changes between runs, the
+    // output is updated in place without touching the blobs; otherwise blobs
+    // compressed before are not compressed again.
+    std::filesystem::path cacheDirectory;
+
+    // packStreaming only: path the output is renamed to once packed, when it
+    // is written next to a file in use and then replaces it. The cache keeps
+    // the layout of the output under this path, and blobs of unchanged inputs
+    // are copied from the file there instead of being read and hashed again.
+    std::filesystem::path finalPath;
+};
+
+struct PackReport {
+    size_t blobCount = 0;
+    size_t duplicateCount = 0;
+    uint64_t storedBytes = 0;
+    uint64_t savedBytes = 0;
+
+    PackReport& operator+=(const PackReport& other);
 };
 
+std::ostream& operator<<(std::ostream& output, const PackReport& report);
+
 flatbuffers::Offset<data::fb::BinaryData> pack(
     flatbuffers::FlatBufferBuilder& builder,
-    const std::vector<std::vector<std::byte>>& blobs);
+    const std::vector<std::vector<std::byte>>& blobs,
+    const BinaryDataPackOptions& options = {},
+    PackReport* report = nullptr);
+
+// Check that every blob of a table that passed flatbuffers::Verifier lies
+// within its data, or within buffer if it is streamed, and that per-blob
+// vectors have an entry for every blob. Throws on the first violation.
+void validate(
+    const fb::BinaryData* fbBinaryData, std::span<const std::byte> buffer);
+
+using BuildRoot = std::function<flatbuffers::Offset<void>(
+    flatbuffers::FlatBufferBuilder& builder,
+    const std::vector<flatbuffers::Offset<fb::BinaryData>>& blobTables)>;
+
+// Write a flatbuffer file, streaming blobs from input files into the output
+// after the flatbuffer itself. Input files are loaded, hashed and compressed in
+// parallel, ahead of the output, within options.ingestMemoryLimit bytes. The
+// output does not depend on the number of threads. With a cache directory, the
+// flatbuffer is followed by some spare room, so that it may grow a little
+// without moving the blobs.
+//
+// blobPaths lists input files for each BinaryData table. buildRoot creates the
+// root table, given offsets of the BinaryData tables in the same order. It is
+// called more than once, and must build the same table every time. If
+// fileIdentifier is given, it follows the root offset, as in
+// flatbuffers::FlatBufferBuilder::Finish.
+PackReport packStreaming(
+    const std::filesystem::path& outputPath,
+    const std::vector<std::vector<std::filesystem::path>>& blobPaths,
+    const BuildRoot& buildRoot,
+    const BinaryDataPackOptions& options = {},
+    const char* fileIdentifier = nullptr);
+
+// Options that outputPath was last packed with by packStreaming, using the
+// cache in cacheDirectory, so that it can be packed again the same way. Empty
+// if the cache does not know the output.
+std::optional<BinaryDataPackOptions> cachedPackOptions(
+    const std::filesystem::path& cacheDirectory,
+    const std::filesystem::path& outputPath);
 
 struct NamedData {
     std::string_view name;
-    std::span<const std::byte> data;
+    Blob data;
 };
 
 class NamedDataStorage {
 public:
-    NamedDataStorage(const fb::Strings* names, const fb::BinaryData* data);
+    NamedDataStorage(
+        const fb::Strings* names,
+        const fb::BinaryData* data,
+        std::span<const std::byte> buffer = {},
+        const BinaryDataOptions& options = {});
 
     [[nodiscard]] IndexIterator<NamedDataStorage> begin() const;
     [[nodiscard]] IndexIterator<NamedDataStorage> end() const;
@@ -102,9 +438,15 @@ public:
     NamedData operator[](uint32_t index) const;
     [[nodiscard]] size_t size() const;
 
+    [[nodiscard]] std::optional<uint32_t> find(std::string_view name) const;
+
+    // Names alone, without touching the blobs
+    [[nodiscard]] const Strings& names() const { return _names; }
+    [[nodiscard]] const BinaryData& data() const { return _data; }
+
 private:
-    const fb::Strings* _names = nullptr;
-    const fb::BinaryData* _data = nullptr;
+    Strings _names;
+    BinaryData _data;
 };
 
 } // namespace data
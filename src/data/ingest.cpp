@@ -0,0 +1,177 @@
+#include "ingest.hpp"
+
+#include "codec.hpp"
+#include "crc32c.hpp"
+#include "error.hpp"
+#include "fs.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace data {
+
+namespace {
+
+// Chunks that blobs stored as they are are read in
+constexpr size_t chunkSize = 4 * 1024 * 1024;
+
+} // namespace
+
+Ingestion::Ingestion(
+        const std::vector<fs::path>& paths,
+        const BinaryDataPackOptions& options,
+        const BuildCache* cache)
+    : _paths(paths)
+    , _options(options)
+    , _cache(cache)
+    , _slots(paths.size())
+{
+    const uint64_t limit = std::max<size_t>(_options.ingestMemoryLimit, 1);
+    for (const auto& path : _paths) {
+        const uint64_t loaded = _options.codec == fb::Codec::None ?
+            std::min<uint64_t>(fs::file_size(path), chunkSize) :
+            fs::file_size(path);
+        _charges.push_back(std::min(loaded, limit));
+    }
+
+    auto threadCount = _options.ingestThreads;
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threadCount = std::min(threadCount, _paths.size());
+    for (size_t i = 0; i < threadCount; i++) {
+        _threads.emplace_back([this] { work(); });
+    }
+}
+
+Ingestion::~Ingestion()
+{
+    {
+        auto lock = std::lock_guard{_mutex};
+        _cancelled = true;
+    }
+    _changed.notify_all();
+}
+
+IngestedBlob Ingestion::next()
+{
+    auto slot = Slot{};
+    {
+        auto lock = std::unique_lock{_mutex};
+        _changed.wait(lock, [this] {
+            const auto& slot = _slots.at(_nextToTake);
+            return slot.blob || slot.error;
+        });
+        slot = std::move(_slots.at(_nextToTake));
+        _loadedBytes -= _charges.at(_nextToTake);
+        _nextToTake++;
+    }
+    _changed.notify_all();
+
+    if (slot.error) {
+        std::rethrow_exception(slot.error);
+    }
+    return std::move(*slot.blob);
+}
+
+void Ingestion::work()
+{
+    const uint64_t limit = std::max<size_t>(_options.ingestMemoryLimit, 1);
+    for (;;) {
+        size_t index = 0;
+        {
+            auto lock = std::unique_lock{_mutex};
+            _changed.wait(lock, [this, limit] {
+                return _cancelled ||
+                    _nextToClaim == _paths.size() ||
+                    _loadedBytes + _charges.at(_nextToClaim) <= limit;
+            });
+            if (_cancelled || _nextToClaim == _paths.size()) {
+                return;
+            }
+            index = _nextToClaim++;
+            _loadedBytes += _charges.at(index);
+        }
+
+        auto slot = Slot{};
+        try {
+            slot.blob = ingest(index);
+        } catch (...) {
+            slot.error = std::current_exception();
+        }
+
+        {
+            auto lock = std::lock_guard{_mutex};
+            _slots.at(index) = std::move(slot);
+        }
+        _changed.notify_all();
+    }
+}
+
+IngestedBlob Ingestion::ingest(size_t index) const
+{
+    const auto& path = _paths.at(index);
+    const auto fileSize = fs::file_size(path);
+    if (fileSize > std::numeric_limits<uint32_t>::max()) {
+        throw Error{} << "blob is too large (" << fileSize << " bytes): " <<
+            path;
+    }
+
+    auto blob = IngestedBlob{};
+    blob.size = static_cast<uint32_t>(fileSize);
+    const bool hashed = _options.deduplicate || _cache;
+    if (_options.codec == fb::Codec::None) {
+        auto hasher = Hasher{};
+        uint64_t readSize = 0;
+        file::readChunks(path, chunkSize, [&] (std::span<const std::byte> chunk) {
+            if (hashed) {
+                hasher.update(chunk);
+            }
+            blob.checksum = crc32c(chunk, blob.checksum);
+            readSize += chunk.size();
+        });
+        if (readSize != fileSize) {
+            throw Error{} << path << " changed while being packed";
+        }
+        if (hashed) {
+            blob.hash = hasher.digest();
+        }
+        blob.copyFromFile = true;
+        return blob;
+    }
+
+    auto bytes = file::read(path);
+    if (bytes.size() != fileSize) {
+        throw Error{} << path << " changed while being packed";
+    }
+    if (hashed) {
+        blob.hash = hash64(bytes);
+    }
+    auto cached = _cache ?
+        _cache->payload(blob.hash, _options.codec, blob.size) : std::nullopt;
+    if (!cached) {
+        cached = CachedPayload{};
+        cached->size = blob.size;
+        auto compressed = compress(_options.codec, bytes);
+        if (compressed.size() < bytes.size()) {
+            cached->codec = _options.codec;
+            cached->stored = std::move(compressed);
+        }
+        if (_cache) {
+            _cache->storePayload(blob.hash, _options.codec, *cached);
+        }
+    }
+    if (cached->codec != fb::Codec::None) {
+        blob.codec = cached->codec;
+        bytes = std::move(cached->stored);
+    }
+    blob.checksum = crc32c(bytes);
+    blob.stored = std::move(bytes);
+    return blob;
+}
+
+} // namespace data
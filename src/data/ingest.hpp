@@ -0,0 +1,78 @@
+#pragma once
+
+#include "build_cache.hpp"
+#include "data.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace data {
+
+struct IngestedBlob {
+    // Hash of the original contents, if deduplicating or caching
+    uint64_t hash = 0;
+    uint32_t size = 0;
+    fb::Codec codec = fb::Codec::None;
+    // CRC-32C of the stored bytes
+    uint32_t checksum = 0;
+    // Empty if the blob is copied from its file, see copyFromFile
+    std::vector<std::byte> stored;
+    // Blobs stored as they are, when not compressing, are only read here in
+    // chunks to hash and check them, and copied from their file by the
+    // consumer
+    bool copyFromFile = false;
+};
+
+// Reads, hashes and compresses input files on a pool of worker threads, ahead
+// of a consumer taking them in order. Files are claimed in order too, and only
+// while the blobs loaded but not yet taken fit in options.ingestMemoryLimit, so
+// the consumer never waits for a file that cannot be loaded. Only blobs being
+// compressed are loaded whole. Compressed blobs are taken from, and added to,
+// the cache if there is one.
+class Ingestion {
+public:
+    Ingestion(
+        const std::vector<std::filesystem::path>& paths,
+        const BinaryDataPackOptions& options,
+        const BuildCache* cache = nullptr);
+    Ingestion(const Ingestion&) = delete;
+    Ingestion& operator=(const Ingestion&) = delete;
+    ~Ingestion();
+
+    // Blob for the next path, waiting for it if necessary. Rethrows an error
+    // that occurred while ingesting it.
+    IngestedBlob next();
+
+private:
+    struct Slot {
+        std::optional<IngestedBlob> blob;
+        std::exception_ptr error;
+    };
+
+    void work();
+    [[nodiscard]] IngestedBlob ingest(size_t index) const;
+
+    const std::vector<std::filesystem::path>& _paths;
+    BinaryDataPackOptions _options;
+    const BuildCache* _cache = nullptr;
+    std::vector<uint64_t> _charges;
+
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::vector<Slot> _slots;
+    size_t _nextToClaim = 0;
+    size_t _nextToTake = 0;
+    uint64_t _loadedBytes = 0;
+    bool _cancelled = false;
+
+    std::vector<std::jthread> _threads;
+};
+
+} // namespace data
@@ -0,0 +1,459 @@
+#include "data.hpp"
+
+#include "build_cache.hpp"
+#include "crc32c.hpp"
+#include "error.hpp"
+#include "fs.hpp"
+#include "hash.hpp"
+#include "ingest.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace data {
+
+namespace {
+
+constexpr size_t chunkSize = 4 * 1024 * 1024;
+
+// Spare room after the flatbuffer, when packing with a cache
+uint64_t spareRoom(uint64_t flatbufferSize)
+{
+    return flatbufferSize / 4 + 4096;
+}
+
+struct StreamedTable {
+    std::vector<fb::Codec> codecs;
+    std::vector<uint32_t> sizes;
+    std::vector<uint32_t> storedSizes;
+    std::vector<uint64_t> externalOffsets;
+    std::vector<uint32_t> checksums;
+};
+
+uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+flatbuffers::DetachedBuffer build(
+    const std::vector<StreamedTable>& tables,
+    const BuildRoot& buildRoot,
+    const BinaryDataPackOptions& options,
+    const char* fileIdentifier)
+{
+    auto builder = flatbuffers::FlatBufferBuilder{};
+    auto blobTables = std::vector<flatbuffers::Offset<fb::BinaryData>>{};
+    for (const auto& table : tables) {
+        auto codecs = builder.CreateVector(table.codecs);
+        auto sizes = builder.CreateVector(table.sizes);
+        auto storedSizes = builder.CreateVector(table.storedSizes);
+        auto externalOffsets = builder.CreateVector(table.externalOffsets);
+        auto checksums = builder.CreateVector(table.checksums);
+        blobTables.push_back(fb::CreateBinaryData(
+            builder,
+            0,
+            0,
+            codecs,
+            sizes,
+            storedSizes,
+            (uint32_t)options.alignment,
+            externalOffsets,
+            checksums));
+    }
+    builder.Finish(buildRoot(builder, blobTables), fileIdentifier);
+    return builder.Release();
+}
+
+void writeBytes(std::ostream& output, std::span<const std::byte> bytes)
+{
+    output.write(
+        reinterpret_cast<const char*>(bytes.data()),
+        static_cast<std::streamsize>(bytes.size()));
+}
+
+// Copy a blob stored as it is from its file, checking that it is still what
+// was ingested
+void copyBlob(
+    std::ostream& output, const fs::path& path, const IngestedBlob& blob)
+{
+    uint64_t size = 0;
+    uint32_t checksum = 0;
+    file::readChunks(path, chunkSize, [&] (std::span<const std::byte> chunk) {
+        writeBytes(output, chunk);
+        checksum = crc32c(chunk, checksum);
+        size += chunk.size();
+    });
+    if (size != blob.size || checksum != blob.checksum) {
+        throw Error{} << path << " changed while being packed";
+    }
+}
+
+bool sameContents(const fs::path& lhsPath, const fs::path& rhsPath)
+{
+    if (fs::file_size(lhsPath) != fs::file_size(rhsPath)) {
+        return false;
+    }
+
+    auto lhs = std::ifstream{};
+    auto rhs = std::ifstream{};
+    lhs.exceptions(std::ios::badbit);
+    rhs.exceptions(std::ios::badbit);
+    lhs.open(lhsPath, std::ios::binary);
+    rhs.open(rhsPath, std::ios::binary);
+
+    auto lhsBuffer = std::vector<char>(chunkSize);
+    auto rhsBuffer = std::vector<char>(chunkSize);
+    while (lhs && rhs) {
+        lhs.read(lhsBuffer.data(), static_cast<std::streamsize>(chunkSize));
+        rhs.read(rhsBuffer.data(), static_cast<std::streamsize>(chunkSize));
+        if (lhs.gcount() != rhs.gcount() ||
+                !std::equal(
+                    lhsBuffer.begin(),
+                    lhsBuffer.begin() + lhs.gcount(),
+                    rhsBuffer.begin())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void fillTables(
+    std::vector<StreamedTable>& tables,
+    const std::vector<PackedInput>& inputs)
+{
+    size_t k = 0;
+    for (auto& table : tables) {
+        for (size_t i = 0; i < table.sizes.size(); i++) {
+            const auto& input = inputs.at(k++);
+            table.codecs.at(i) = input.codec;
+            table.sizes.at(i) = input.size;
+            table.storedSizes.at(i) = input.storedSize;
+            table.externalOffsets.at(i) = input.offset;
+            table.checksums.at(i) = input.checksum;
+        }
+    }
+}
+
+// Blobs stored at the same place as an earlier blob are duplicates
+PackReport reportFor(const std::vector<PackedInput>& inputs)
+{
+    auto report = PackReport{};
+    auto stored = std::set<std::pair<uint64_t, uint32_t>>{};
+    for (const auto& input : inputs) {
+        report.blobCount++;
+        if (stored.emplace(input.offset, input.storedSize).second) {
+            report.storedBytes += input.storedSize;
+        } else {
+            report.duplicateCount++;
+            report.savedBytes += input.storedSize;
+        }
+    }
+    return report;
+}
+
+// Whether the blobs of a previous run are still valid for the given inputs,
+// which is the case if the output was not modified since, and each input has
+// the same contents. Inputs are only read if their size or modification time
+// changed.
+bool reusable(
+    PackedLayout& layout,
+    const fs::path& outputPath,
+    const std::vector<fs::path>& paths,
+    const BinaryDataPackOptions& options)
+{
+    if (layout.codec != options.codec ||
+            layout.alignment != options.alignment ||
+            layout.deduplicate != options.deduplicate ||
+            layout.inputs.size() != paths.size() ||
+            !fs::exists(outputPath) ||
+            fs::file_size(outputPath) != layout.outputSize ||
+            fileTime(outputPath) != layout.outputTime) {
+        return false;
+    }
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        auto& input = layout.inputs.at(i);
+        const auto path = fs::absolute(paths.at(i)).lexically_normal();
+        if (!fs::exists(path)) {
+            return false;
+        }
+        const uint64_t size = fs::file_size(path);
+        const auto time = fileTime(path);
+        if (path == input.path && size == input.fileSize &&
+                time == input.fileTime) {
+            continue;
+        }
+        if (size != input.size || hashFile(path) != input.hash) {
+            return false;
+        }
+        input.path = path;
+        input.fileSize = size;
+        input.fileTime = time;
+    }
+    return true;
+}
+
+// Inputs of a previous output that may be copied from it as they are stored:
+// the output is as it was packed, with the same codec, and each input file
+// still has the same size and modification time
+std::map<fs::path, PackedInput> reusableInputs(
+    const PackedLayout& layout,
+    const fs::path& outputPath,
+    const BinaryDataPackOptions& options)
+{
+    auto inputs = std::map<fs::path, PackedInput>{};
+    if (layout.codec != options.codec ||
+            !fs::exists(outputPath) ||
+            fs::file_size(outputPath) != layout.outputSize ||
+            fileTime(outputPath) != layout.outputTime) {
+        return inputs;
+    }
+    for (const auto& input : layout.inputs) {
+        if (fs::exists(input.path) &&
+                fs::file_size(input.path) == input.fileSize &&
+                fileTime(input.path) == input.fileTime) {
+            inputs.emplace(input.path, input);
+        }
+    }
+    return inputs;
+}
+
+// Write zeros in place of the flatbuffer, followed by all blobs. Blobs of
+// inputs in reused are copied from previousPath instead of being ingested
+// again: the stream leaves holes for them, which are filled in by the kernel
+// once it is closed.
+PackedLayout writeBlobs(
+    const fs::path& outputPath,
+    const std::vector<fs::path>& paths,
+    uint64_t blobsStart,
+    const BinaryDataPackOptions& options,
+    const BuildCache* cache,
+    const fs::path& previousPath = {},
+    const std::map<fs::path, PackedInput>& reused = {})
+{
+    auto layout = PackedLayout{
+        .codec = options.codec,
+        .alignment = options.alignment,
+        .deduplicate = options.deduplicate,
+        .blobsStart = blobsStart,
+        .outputSize = 0,
+        .outputTime = 0,
+        .inputs = {},
+    };
+
+    auto output = std::ofstream{};
+    output.exceptions(std::ios::badbit | std::ios::failbit);
+    output.open(outputPath, std::ios::binary | std::ios::trunc);
+    writeBytes(output, std::vector<std::byte>(blobsStart));
+
+    auto normalPaths = std::vector<fs::path>{};
+    auto ingestedPaths = std::vector<fs::path>{};
+    for (const auto& path : paths) {
+        normalPaths.push_back(fs::absolute(path).lexically_normal());
+        if (!reused.contains(normalPaths.back())) {
+            ingestedPaths.push_back(path);
+        }
+    }
+
+    struct Copy {
+        uint64_t from = 0;
+        uint64_t size = 0;
+        uint64_t to = 0;
+    };
+    auto copies = std::vector<Copy>{};
+
+    auto storedBlobsByHash = std::unordered_map<uint64_t, std::vector<size_t>>{};
+    auto ingestion = Ingestion{ingestedPaths, options, cache};
+    const auto padding = std::vector<std::byte>(options.alignment);
+    uint64_t position = blobsStart;
+    for (size_t i = 0; i < paths.size(); i++) {
+        const auto& path = paths.at(i);
+        const auto previous = reused.find(normalPaths.at(i));
+        auto blob = IngestedBlob{};
+        if (previous == reused.end()) {
+            blob = ingestion.next();
+            layout.inputs.push_back(PackedInput{
+                .path = normalPaths.at(i),
+                .fileSize = blob.size,
+                .fileTime = fileTime(path),
+                .hash = blob.hash,
+                .codec = blob.codec,
+                .size = blob.size,
+                .storedSize = blob.copyFromFile ?
+                    blob.size : static_cast<uint32_t>(blob.stored.size()),
+                .offset = 0,
+                .checksum = blob.checksum,
+            });
+        } else {
+            layout.inputs.push_back(previous->second);
+        }
+        auto& input = layout.inputs.back();
+
+        if (options.deduplicate) {
+            auto& candidates = storedBlobsByHash[input.hash];
+            auto original = std::ranges::find_if(
+                candidates, [&] (size_t candidate) {
+                    return sameContents(paths.at(candidate), path);
+                });
+            if (original != candidates.end()) {
+                const auto& originalInput = layout.inputs.at(*original);
+                input.codec = originalInput.codec;
+                input.storedSize = originalInput.storedSize;
+                input.offset = originalInput.offset;
+                input.checksum = originalInput.checksum;
+                continue;
+            }
+            candidates.push_back(i);
+        }
+
+        const uint64_t blobStart = alignUp(position, options.alignment);
+        writeBytes(output, std::span{padding}.first(blobStart - position));
+        position = blobStart;
+        if (previous != reused.end()) {
+            copies.push_back(Copy{
+                .from = input.offset,
+                .size = input.storedSize,
+                .to = position,
+            });
+            output.seekp(
+                static_cast<std::streamoff>(input.storedSize), std::ios::cur);
+        } else if (blob.copyFromFile) {
+            copyBlob(output, path, blob);
+        } else {
+            writeBytes(output, blob.stored);
+        }
+        input.offset = position;
+        position += input.storedSize;
+    }
+
+    output.close();
+    for (const auto& copy : copies) {
+        file::copyRange(previousPath, copy.from, copy.size, outputPath, copy.to);
+    }
+    return layout;
+}
+
+// Write the flatbuffer over the start of an existing output file, padding it
+// with zeros up to the first blob
+void writeFlatbuffer(
+    const fs::path& outputPath,
+    const flatbuffers::DetachedBuffer& flatbuffer,
+    uint64_t blobsStart)
+{
+    auto output = std::fstream{};
+    output.exceptions(std::ios::badbit | std::ios::failbit);
+    output.open(outputPath, std::ios::binary | std::ios::in | std::ios::out);
+    writeBytes(
+        output,
+        {reinterpret_cast<const std::byte*>(flatbuffer.data()), flatbuffer.size()});
+    writeBytes(output, std::vector<std::byte>(blobsStart - flatbuffer.size()));
+}
+
+} // namespace
+
+PackReport packStreaming(
+    const fs::path& outputPath,
+    const std::vector<std::vector<fs::path>>& blobPaths,
+    const BuildRoot& buildRoot,
+    const BinaryDataPackOptions& options,
+    const char* fileIdentifier)
+{
+    if (options.alignment == 0 ||
+            (options.alignment & (options.alignment - 1)) != 0) {
+        throw Error{} << "blob alignment must be a power of two, got " <<
+            options.alignment;
+    }
+
+    auto paths = std::vector<fs::path>{};
+    for (const auto& tablePaths : blobPaths) {
+        paths.insert(paths.end(), tablePaths.begin(), tablePaths.end());
+    }
+
+    // Sizes of all vectors are known in advance, so the size of the flatbuffer
+    // does not depend on the values in them.
+    auto tables = std::vector<StreamedTable>{};
+    for (const auto& tablePaths : blobPaths) {
+        const auto count = tablePaths.size();
+        tables.push_back(StreamedTable{
+            .codecs = std::vector<fb::Codec>(count, fb::Codec::None),
+            .sizes = std::vector<uint32_t>(count),
+            .storedSizes = std::vector<uint32_t>(count),
+            .externalOffsets = std::vector<uint64_t>(count),
+            .checksums = std::vector<uint32_t>(count),
+        });
+    }
+
+    auto cache = std::optional<BuildCache>{};
+    if (!options.cacheDirectory.empty()) {
+        cache.emplace(options.cacheDirectory);
+    }
+
+    // An output packed to replace another starts from the blobs of the one it
+    // replaces. Any other output is updated in place, if the blobs did not
+    // change, and the flatbuffer still fits in front of them.
+    const auto cachedPath =
+        options.finalPath.empty() ? outputPath : options.finalPath;
+    const auto previous =
+        cache ? cache->layout(cachedPath) : std::optional<PackedLayout>{};
+    auto reused = std::map<fs::path, PackedInput>{};
+    if (previous && !options.finalPath.empty()) {
+        reused = reusableInputs(*previous, options.finalPath, options);
+    }
+
+    auto layout = options.finalPath.empty() ?
+        previous : std::optional<PackedLayout>{};
+    if (layout && reusable(*layout, outputPath, paths, options)) {
+        fillTables(tables, layout->inputs);
+        const auto flatbuffer =
+            build(tables, buildRoot, options, fileIdentifier);
+        if (flatbuffer.size() <= layout->blobsStart) {
+            writeFlatbuffer(outputPath, flatbuffer, layout->blobsStart);
+        } else {
+            layout.reset();
+        }
+    } else {
+        layout.reset();
+    }
+
+    if (!layout) {
+        const uint64_t flatbufferSize =
+            build(tables, buildRoot, options, fileIdentifier).size();
+        const uint64_t blobsStart =
+            cache ? flatbufferSize + spareRoom(flatbufferSize) : flatbufferSize;
+        layout = writeBlobs(
+            outputPath,
+            paths,
+            blobsStart,
+            options,
+            cache ? &*cache : nullptr,
+            options.finalPath,
+            reused);
+
+        fillTables(tables, layout->inputs);
+        const auto flatbuffer =
+            build(tables, buildRoot, options, fileIdentifier);
+        if (flatbuffer.size() != flatbufferSize) {
+            throw Error{} << "flatbuffer size changed from " << flatbufferSize <<
+                " to " << flatbuffer.size() << " bytes between passes";
+        }
+        writeFlatbuffer(outputPath, flatbuffer, blobsStart);
+    }
+
+    if (cache) {
+        layout->outputSize = fs::file_size(outputPath);
+        layout->outputTime = fileTime(outputPath);
+        // Renaming keeps the size and modification time
+        cache->storeLayout(cachedPath, *layout);
+        cache->prune();
+    }
+    return reportFor(layout->inputs);
+}
+
+} // namespace data
@@ -6,11 +6,11 @@
 
 #include <cstdlib>
 #include <fstream>
-#include <iostream>
 #include <mutex>
 #include <string>
 
 #include "error.hpp"
+#include "logging.hpp"
 
 namespace fs = std::filesystem;
 
@@ -28,6 +28,8 @@ void serialize(Config& config, const S& s)
     s(config.gameFps, "game fps");
     s(config.fullscreen, "fullscreen");
     s(config.mute, "mute");
+    s(config.audioFrequency, "audio frequency");
+    s(config.audioBufferSamples, "audio buffer samples");
 }
 
 } // namespace
@@ -39,7 +41,7 @@ Config& config()
 
 void loadConfigFromFile(const fs::path& path)
 {
-    std::cout << "loading config from " << path << "\n";
+    LOG(Info) << "loading config from " << path;
     auto yaml = YAML::LoadFile(path.string());
 
     auto lock = std::lock_guard{globalConfigMutex};
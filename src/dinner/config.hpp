@@ -10,6 +10,11 @@ struct Config {
     int gameFps = 60;
     bool fullscreen = true;
     bool mute = false;
+    // Music is resampled to 48000 Hz at pack time (see booka --audio-rate),
+    // so that it plays without resampling at the default frequency
+    int audioFrequency = 48000;
+    // Smaller buffers lower latency, at the risk of audio dropouts
+    int audioBufferSamples = 1024;
 };
 
 Config& config();
@@ -0,0 +1,189 @@
+#include "hot_reload.hpp"
+
+#include "logging.hpp"
+
+#include <data.hpp>
+#include <repa.hpp>
+#include <script.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <set>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+fs::path normalized(const fs::path& path)
+{
+    return fs::absolute(path).lexically_normal();
+}
+
+bool anyOf(
+    const std::set<fs::path>& changes, const std::vector<fs::path>& paths)
+{
+    return std::ranges::any_of(paths, [&] (const fs::path& path) {
+        return changes.contains(normalized(path));
+    });
+}
+
+// Pack into a file next to the target, then rename it over the target, which
+// may be mapped by the game. The build cache knows the packed file by the
+// target's path (see BinaryDataPackOptions::finalPath).
+template <class F>
+void replace(const fs::path& target, F&& pack)
+{
+    auto temporary = target;
+    temporary += ".reload";
+    pack(temporary);
+    fs::rename(temporary, target);
+}
+
+// Pack with the options the build packed the target with, which its cached
+// layout records, so that unchanged blobs are copied from the target
+data::BinaryDataPackOptions packOptions(
+    const fs::path& target, const fs::path& cacheDirectory)
+{
+    auto options = data::cachedPackOptions(cacheDirectory, target)
+        .value_or(data::BinaryDataPackOptions{});
+    options.cacheDirectory = cacheDirectory;
+    options.finalPath = target;
+    return options;
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+HotReload::HotReload(HotReloadPaths paths)
+    : _paths(std::move(paths))
+{
+    updateInputs(true, true);
+}
+
+HotReload::Changes HotReload::poll()
+{
+    const auto changed = _watcher.changes();
+    if (!changed.empty()) {
+        _pending.story = _pending.story || anyOf(changed, _storyInputs);
+        _pending.resources =
+            _pending.resources || anyOf(changed, _resourceInputs);
+    }
+
+    auto changes = Changes{};
+    if (_packing.valid() &&
+            _packing.wait_for(std::chrono::seconds{0}) ==
+                std::future_status::ready) {
+        changes = _packing.get();
+        if (changes.story || changes.resources) {
+            updateInputs(changes.story, changes.resources);
+        }
+    }
+
+    if (!_packing.valid() && (_pending.story || _pending.resources)) {
+        _packing = std::async(
+            std::launch::async,
+            [this, requested = std::exchange(_pending, {})] {
+                return pack(requested);
+            });
+    }
+    return changes;
+}
+
+// Files to watch are read from the script and manifest. If they cannot be
+// read, only the script or manifest itself is watched, until it is fixed.
+void HotReload::updateInputs(bool story, bool resources)
+{
+    if (story) {
+        _storyInputs = {_paths.script};
+        try {
+            const auto unpackedBooka = booka::parseScript(_paths.script);
+            _storyInputs.insert(
+                _storyInputs.end(),
+                unpackedBooka.imagePaths.begin(),
+                unpackedBooka.imagePaths.end());
+            _storyInputs.insert(
+                _storyInputs.end(),
+                unpackedBooka.musicPaths.begin(),
+                unpackedBooka.musicPaths.end());
+        } catch (const std::exception& e) {
+            LOG(Error) << "cannot read story script: " << e.what();
+        }
+    }
+
+    if (resources) {
+        _resourceInputs = {_paths.manifest};
+        try {
+            for (const auto& source : repa::loadManifest(_paths.manifest).sources) {
+                _resourceInputs.push_back(source.path);
+            }
+        } catch (const std::exception& e) {
+            LOG(Error) << "cannot read resource manifest: " << e.what();
+        }
+    }
+
+    auto paths = _storyInputs;
+    paths.insert(paths.end(), _resourceInputs.begin(), _resourceInputs.end());
+    _watcher.watch(paths);
+}
+
+HotReload::Changes HotReload::pack(Changes requested) const
+{
+    auto packed = Changes{};
+    if (requested.story) {
+        packed.story = packStory();
+    }
+    if (requested.resources) {
+        packed.resources = packResources();
+    }
+    return packed;
+}
+
+// Images and music are packed as they are, without decoding or transcoding,
+// which the game handles too
+bool HotReload::packStory() const
+{
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        auto unpackedBooka = booka::parseScript(_paths.script);
+        replace(_paths.story, [&] (const fs::path& path) {
+            unpackedBooka.pack(
+                path, packOptions(_paths.story, _paths.cacheDirectory));
+        });
+    } catch (const std::exception& e) {
+        LOG(Error) << "cannot pack story: " << e.what();
+        return false;
+    }
+    LOG(Info) << "packed story " << _paths.story << " in " <<
+        millisecondsSince(start) << " ms";
+    return true;
+}
+
+bool HotReload::packResources() const
+{
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        replace(_paths.resources, [&] (const fs::path& path) {
+            // The game only checks resource names against its header, which
+            // is left alone, so that the game is not rebuilt
+            repa::packByYaml(
+                _paths.manifest,
+                {},
+                path,
+                packOptions(_paths.resources, _paths.cacheDirectory));
+        });
+    } catch (const std::exception& e) {
+        LOG(Error) << "cannot pack resources: " << e.what();
+        return false;
+    }
+    LOG(Info) << "packed resources " << _paths.resources << " in " <<
+        millisecondsSince(start) << " ms";
+    return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "file_watcher.hpp"
+
+#include <filesystem>
+#include <future>
+#include <vector>
+
+struct HotReloadPaths {
+    std::filesystem::path script;
+    std::filesystem::path story;
+    std::filesystem::path manifest;
+    std::filesystem::path resources;
+    std::filesystem::path cacheDirectory;
+};
+
+// Development mode: watches the story script and resource manifest, and the
+// files they list, and packs the story or resources again when any of them
+// changes. Packed files are written next to their targets and renamed over
+// them, so that files mapped by the running game stay valid until it reopens
+// them. Packing runs on a thread of its own, so that the game keeps drawing
+// frames meanwhile.
+class HotReload {
+public:
+    struct Changes {
+        bool story = false;
+        bool resources = false;
+    };
+
+    explicit HotReload(HotReloadPaths paths);
+
+    // Start packing again whatever changed since the last call, unless
+    // packing is already in progress, in which case the changes are packed
+    // after it. Reports what was packed successfully once packing is done, and
+    // nothing before; errors, such as in a script being edited, are logged.
+    Changes poll();
+
+private:
+    void updateInputs(bool story, bool resources);
+    [[nodiscard]] Changes pack(Changes requested) const;
+    [[nodiscard]] bool packStory() const;
+    [[nodiscard]] bool packResources() const;
+
+    HotReloadPaths _paths;
+    FileWatcher _watcher;
+    std::vector<std::filesystem::path> _storyInputs;
+    std::vector<std::filesystem::path> _resourceInputs;
+    // Changes noticed while packing
+    Changes _pending;
+    // Declared last, so that it waits for packing before the rest is destroyed
+    std::future<Changes> _packing;
+};
@@ -1,11 +1,14 @@
+#include "build-info.hpp"
 #include "config.hpp"
+#include "hot_reload.hpp"
+#include "logging.hpp"
 #include "overloaded.hpp"
-#include "repa.hpp"
 #include "resources.hpp"
 #include "sdl.hpp"
 #include "view.hpp"
 
 #include <booka.hpp>
+#include <repa.hpp>
 
 #include <arg.hpp>
 #include <tempo.hpp>
@@ -16,10 +19,37 @@
 #include <cstdlib>
 #include <exception>
 #include <filesystem>
-#include <iostream>
+#include <memory>
+#include <optional>
 
 namespace fs = std::filesystem;
 
+namespace {
+
+// Open what was packed again. A story or resources that cannot be opened, or
+// do not fit the running game, are skipped, and the old ones kept.
+void reload(View& view, HotReload& hotReload, const fs::path& storyFilePath)
+{
+    const auto changes = hotReload.poll();
+    if (changes.story) {
+        try {
+            view.reloadStory(std::make_unique<booka::Booka>(storyFilePath));
+        } catch (const std::exception& e) {
+            LOG(Error) << "cannot reload story: " << e.what();
+        }
+    }
+    if (changes.resources) {
+        try {
+            view.reloadResources(std::make_unique<repa::Repa>(
+                bi::BUILD_ROOT / "assets" / "resources.fb"));
+        } catch (const std::exception& e) {
+            LOG(Error) << "cannot reload resources: " << e.what();
+        }
+    }
+}
+
+} // namespace
+
 #ifdef __cplusplus
 extern "C"
 #endif
@@ -32,32 +62,61 @@ int main(int argc, char* argv[]) try
     auto mute = arg::flag()
         .keys("--mute")
         .help("mute all game sound");
+    auto verify = arg::flag()
+        .keys("--verify")
+        .help("check the story file for corruption before playing it");
+    auto watch = arg::flag()
+        .keys("--watch")
+        .help("pack the story and resources again when their files change, "
+            "and reload them while playing");
+    auto scriptFilePath = arg::option<fs::path>()
+        .keys("--script")
+        .defaultValue(bi::SOURCE_ROOT / "assets" / "test-1" / "script.txt")
+        .help("with --watch: script the story file is packed from");
+    auto manifestFilePath = arg::option<fs::path>()
+        .keys("--manifest")
+        .defaultValue(bi::SOURCE_ROOT / "assets" / "manifest.yaml")
+        .help("with --watch: manifest the resources are packed from");
     arg::parse(argc, argv);
 
-    auto repa = repa::Repa{bi::BUILD_ROOT / "assets" / "resources.fb"};
-
     processConfig();
     if (mute) {
         config().mute = true;
     }
 
-    std::cout << "initializing SDL\n";
+    LOG(Info) << "initializing SDL";
     sdl::check(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_EVENTS));
     sdl::check(TTF_Init());
     constexpr auto imgInitFlags = IMG_INIT_PNG;
     sdl::check(IMG_Init(imgInitFlags) == imgInitFlags);
 
-    sdl::check(Mix_OpenAudio(22050, MIX_DEFAULT_FORMAT, 2, 4096));
+    sdl::check(Mix_OpenAudio(
+        config().audioFrequency,
+        MIX_DEFAULT_FORMAT,
+        2,
+        config().audioBufferSamples));
     Mix_VolumeMusic(40);
 
     {
-        std::cout << "loading booka story from " << storyFilePath << "\n";
-        auto booka = booka::Booka{storyFilePath};
-
-        std::cout << "creating view\n";
-        auto view = View{booka};
+        LOG(Info) << "loading booka story from " << storyFilePath;
+        LOG(Info) << "creating view";
+        auto view = View{std::make_unique<booka::Booka>(
+            storyFilePath, booka::LoadOptions{.verify = verify})};
+
+        auto hotReload = std::optional<HotReload>{};
+        if (watch) {
+            LOG(Info) << "watching " << scriptFilePath << " and " <<
+                manifestFilePath;
+            hotReload.emplace(HotReloadPaths{
+                .script = scriptFilePath,
+                .story = storyFilePath,
+                .manifest = manifestFilePath,
+                .resources = bi::BUILD_ROOT / "assets" / "resources.fb",
+                .cacheDirectory = bi::BUILD_ROOT / "assets" / "pack-cache",
+            });
+        }
 
-        std::cout << "starting game\n";
+        LOG(Info) << "starting game";
         bool done = false;
         auto frameTimer = tempo::FrameTimer{config().gameFps};
         while (!done) {
@@ -65,6 +124,10 @@ int main(int argc, char* argv[]) try
                 break;
             }
 
+            if (hotReload) {
+                reload(view, *hotReload, storyFilePath);
+            }
+
             if (frameTimer() > 0) {
                 view.present();
             }
@@ -79,6 +142,6 @@ int main(int argc, char* argv[]) try
 
     return EXIT_SUCCESS;
 } catch (const std::exception& e) {
-    std::cerr << e.what() << "\n";
+    LOG(Error) << e.what();
     return EXIT_FAILURE;
 }
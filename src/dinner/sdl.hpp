@@ -182,6 +182,24 @@ public:
         };
     }
 
+    // Texture uploaded from rows of pixels in the given format, without
+    // decoding or converting them
+    sdl::Texture createTexture(
+        Uint32 format,
+        int width,
+        int height,
+        std::span<const std::byte> pixels,
+        int pitch)
+    {
+        auto texture = sdl::Texture{sdl::check(SDL_CreateTexture(
+            _ptr.get(), format, SDL_TEXTUREACCESS_STATIC, width, height))};
+        sdl::check(SDL_UpdateTexture(texture, nullptr, pixels.data(), pitch));
+        if (SDL_ISPIXELFORMAT_ALPHA(format)) {
+            sdl::check(SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND));
+        }
+        return texture;
+    }
+
     sdl::Texture createTextureFromSurface(sdl::Surface& surface)
     {
         return sdl::Texture{
@@ -10,14 +10,46 @@
 
 #include <SDL_image.h>
 
-#include <iostream>
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
 #include <variant>
 
-View::View(booka::Booka& booka)
-    : _booka(booka)
-    , _actionIterator(_booka.actions().begin())
-    , _repa(bi::BUILD_ROOT / "assets" / "resources.fb")
+#ifdef DINNER_EMBEDDED_RESOURCES
+extern "C" const std::byte dinner_embedded_resources_begin[];
+extern "C" const std::byte dinner_embedded_resources_end[];
+#endif
+
+namespace {
+
+constexpr size_t maxRewindSteps = 256;
+
+// Resources linked into the executable, or mapped from the build tree
+std::unique_ptr<repa::Repa> openResources()
+{
+#ifdef DINNER_EMBEDDED_RESOURCES
+    return std::make_unique<repa::Repa>(std::span{
+        dinner_embedded_resources_begin, dinner_embedded_resources_end});
+#else
+    return std::make_unique<repa::Repa>(
+        bi::BUILD_ROOT / "assets" / "resources.fb");
+#endif
+}
+
+} // namespace
+
+View::View(std::unique_ptr<booka::Booka> booka)
+    : _booka(std::move(booka))
+    , _interpreter(*_booka)
+    , _repa(openResources())
 {
+    _repa->check<R>();
+
     auto createWindowFlags = Uint32{0};
     if (config().fullscreen) {
         createWindowFlags |= SDL_WINDOW_FULLSCREEN_DESKTOP;
@@ -36,7 +68,8 @@ View::View(booka::Booka& booka)
 
     sdl::check(SDL_SetRenderDrawBlendMode(_renderer, SDL_BLENDMODE_BLEND));
 
-    _font = ttf::Font{_repa((size_t)R::FONT_OPEN_SANS), 32};
+    _fontData = _repa->get<R::FONT_OPEN_SANS>().data;
+    _font = ttf::Font{_fontData, 32};
 
     _characterBox = _widgets.add<SpeechBox>(
         _renderer,
@@ -52,24 +85,84 @@ View::View(booka::Booka& booka)
         SDL_Color{0, 0, 0, 255},
         SpeechBox::Mode::Wrappy);
 
-    _widgets.add<Button>(
+    _quitButton = _widgets.add<Button>(
         1670, 50, 200, 50,
-        _repa((size_t)R::FONT_OPEN_SANS),
+        _fontData,
         "Quit",
         [this] {
-            std::cout << "quit button pressed\n";
+            LOG(Debug) << "quit button pressed";
             _signalToExit = true;
         });
 
     update();
 
-    for (const auto& image : _booka.images()) {
-        std::cout << "loading image '" << image.name << "', " <<
-            Size{image.data.size()} << "\n";
-        _textures.push_back(_renderer.loadTextureFromMemory(image.data));
+    for (uint32_t i = 0; i < _booka->images().size(); i++) {
+        _textures.push_back(createTexture(*_booka, i));
+    }
+}
+
+void View::reloadStory(std::unique_ptr<booka::Booka> booka)
+{
+    auto interpreter = booka::Interpreter{*booka};
+    if (const auto action = _interpreter.lastAction()) {
+        if (*action >= booka->actions().size()) {
+            LOG(Warning) << "starting the story over: it now has " <<
+                booka->actions().size() << " actions, was at " << *action;
+        } else {
+            try {
+                interpreter.seek(*action);
+            } catch (const std::exception& e) {
+                LOG(Warning) << "starting the story over: " << e.what();
+            }
+        }
+    }
+    for (uint32_t i = 0; i < _interpreter.variableCount(); i++) {
+        interpreter.setVariable(
+            _interpreter.variableName(i), _interpreter.variable(i));
+    }
+
+    auto textures = std::vector<sdl::Texture>{};
+    for (uint32_t i = 0; i < booka->images().size(); i++) {
+        const auto image = booka->images()[i];
+        if (i < _textures.size() &&
+                image.name == _booka->images()[i].name &&
+                std::ranges::equal(image.data, _booka->images()[i].data)) {
+            textures.push_back(std::move(_textures.at(i)));
+        } else {
+            textures.push_back(createTexture(*booka, i));
+        }
+    }
+
+    // Music streams from the mapped booka, so it must stop before the booka is
+    // closed
+    _music.reset();
+    _musicData = {};
+    _booka = std::move(booka);
+    _interpreter = std::move(interpreter);
+    _textures = std::move(textures);
+    _history.clear();
+    _choiceSize = 0;
+
+    const auto& state = _interpreter.state();
+    _backgroundIndex = state.imageIndex ? *state.imageIndex : size_t(-1);
+    playMusic(state.musicIndex);
+    if (!update()) {
+        _signalToExit = true;
     }
 }
 
+void View::reloadResources(std::unique_ptr<repa::Repa> repa)
+{
+    repa->checkNames<R>();
+
+    // Text already shown keeps the old font until it changes
+    auto fontData = repa->get<R::FONT_OPEN_SANS>().data;
+    _font = ttf::Font{fontData, 32};
+    _quitButton->setFontData(fontData);
+    _fontData = std::move(fontData);
+    _repa = std::move(repa);
+}
+
 bool View::processInput()
 {
     auto event = SDL_Event{};
@@ -80,7 +173,21 @@ bool View::processInput()
             return false;
         }
 
-        if (event.type == SDL_MOUSEBUTTONDOWN &&
+        if (event.type == SDL_KEYDOWN &&
+                event.key.keysym.sym == SDLK_BACKSPACE) {
+            if (!rewind()) {
+                return false;
+            }
+        } else if (_choiceSize > 0 && event.type == SDL_KEYDOWN &&
+                event.key.keysym.sym >= SDLK_1 &&
+                event.key.keysym.sym <
+                    SDLK_1 + (int)std::min<size_t>(_choiceSize, 9)) {
+            _interpreter.select((uint32_t)(event.key.keysym.sym - SDLK_1));
+            _choiceSize = 0;
+            if (!update()) {
+                return false;
+            }
+        } else if (event.type == SDL_MOUSEBUTTONDOWN &&
                 event.button.button == SDL_BUTTON_LEFT) {
             bool processed = _widgets.press(event.button.x, event.button.y);
             if (!processed) {
@@ -115,44 +222,34 @@ void View::present()
 
 bool View::update()
 {
-    if (_actionIterator == _booka.actions().end()) {
-        return false;
+    // Clicks do not skip a choice; it is picked with number keys
+    if (_choiceSize > 0) {
+        return true;
+    }
+
+    _history.push_back(_interpreter.save());
+    if (_history.size() > maxRewindSteps) {
+        _history.pop_front();
     }
 
     for (;;) {
         bool repeat = false;
+        bool finished = false;
         std::visit(Overloaded{
-            [&] (const booka::ShowImageAction& showImageAction) {
-                std::cout << "show image action\n";
-                _backgroundIndex = showImageAction.imageIndex;
-                _speechBox->hide();
-
-
-                // TODO: remove
-                repeat = true;
+            [&] (const booka::Action& action) {
+                repeat = show(action);
             },
-            [&] (const booka::ShowTextAction& showTextAction) {
-                if (showTextAction.character.empty()) {
-                    _characterBox->hide();
-                } else {
-                    _characterBox->showText(std::string{showTextAction.character});
-                }
-
-                std::cout << "show text action\n";
-                _speechBox->showText(std::string{showTextAction.text});
+            [&] (const booka::Choice& choice) {
+                showChoice(choice);
             },
-            [&] (const booka::PlayMusicAction& playMusicAction) {
-                auto music = _booka.music()[playMusicAction.musicIndex];
-                _music.reset(sdl::check(Mix_LoadMUS_RW(
-                    SDL_RWFromMem((void*)music.data.data(), (int)music.data.size()),
-                    1)));
-                if (!config().mute) {
-                    sdl::check(Mix_PlayMusic(_music.get(), -1));
-                }
-                repeat = true;
+            [&] (const booka::Finish&) {
+                finished = true;
             },
-        }, *_actionIterator++);
+        }, _interpreter.step());
 
+        if (finished) {
+            return false;
+        }
         if (!repeat) {
             break;
         }
@@ -160,3 +257,124 @@ bool View::update()
 
     return true;
 }
+
+// Present an action. Returns whether to go on to the next one right away.
+bool View::show(const booka::Action& action)
+{
+    bool repeat = false;
+    std::visit(Overloaded{
+        [&] (const booka::ShowImageAction& showImageAction) {
+            LOG(Trace) << "show image action";
+            _backgroundIndex = showImageAction.imageIndex;
+            _speechBox->hide();
+
+
+            // TODO: remove
+            repeat = true;
+        },
+        [&] (const booka::ShowTextAction& showTextAction) {
+            if (showTextAction.character.empty()) {
+                _characterBox->hide();
+            } else {
+                _characterBox->showText(std::string{showTextAction.character});
+            }
+
+            LOG(Trace) << "show text action";
+            _speechBox->showText(std::string{showTextAction.text});
+        },
+        [&] (const booka::PlayMusicAction& playMusicAction) {
+            playMusic(playMusicAction.musicIndex);
+            repeat = true;
+        },
+        [&] (const booka::UnknownAction& unknownAction) {
+            LOG(Debug) << "skipping action of unknown type " <<
+                (int)unknownAction.type;
+            repeat = true;
+        },
+    }, action);
+    return repeat;
+}
+
+void View::playMusic(std::optional<uint32_t> musicIndex)
+{
+    _musicIndex = musicIndex;
+    if (!musicIndex) {
+        _music.reset();
+        _musicData = {};
+        return;
+    }
+
+    // Music is decoded while playing, a little at a time, straight from the
+    // mapped booka, or from its decompressed copy. Reading it in ahead keeps
+    // page faults off the audio thread. The music playing stops before its
+    // data is released.
+    _music.reset();
+    _musicData = _booka->music()[*musicIndex].data;
+    _booka->file().willNeed(_musicData);
+    _music.reset(sdl::check(Mix_LoadMUS_RW(
+        sdl::check(SDL_RWFromConstMem(
+            _musicData.data(), (int)_musicData.size())),
+        1)));
+    if (!config().mute) {
+        sdl::check(Mix_PlayMusic(_music.get(), -1));
+    }
+}
+
+sdl::Texture View::createTexture(
+    const booka::Booka& booka, uint32_t imageIndex)
+{
+    const auto image = booka.images()[imageIndex];
+    LOG(Debug) << "loading image '" << image.name << "', " <<
+        Size{image.data.size()};
+    auto texture = sdl::Texture{};
+    if (const auto pixels = booka.imagePixels(imageIndex)) {
+        texture = _renderer.createTexture(
+            pixels->pixelFormat(),
+            (int)pixels->width(),
+            (int)pixels->height(),
+            image.data,
+            (int)pixels->pitch());
+    } else {
+        texture = _renderer.loadTextureFromMemory(image.data);
+    }
+    // The texture has its own copy now
+    booka.file().dontNeed(image.data);
+    return texture;
+}
+
+// Go back to the step before the current one. The state it was shown in comes
+// with the snapshot, so nothing before it is replayed.
+bool View::rewind()
+{
+    if (_history.size() < 2) {
+        return true;
+    }
+    _history.pop_back();
+    const auto snapshot = std::move(_history.back());
+    _history.pop_back();
+
+    _interpreter.restore(snapshot);
+    _backgroundIndex = snapshot.state.imageIndex ?
+        *snapshot.state.imageIndex : size_t(-1);
+    if (snapshot.state.musicIndex != _musicIndex) {
+        playMusic(snapshot.state.musicIndex);
+    }
+    _choiceSize = 0;
+    return update();
+}
+
+// Options are listed in the speech box, numbered from 1, and picked with the
+// number keys
+void View::showChoice(const booka::Choice& choice)
+{
+    LOG(Trace) << "choice of " << choice.size();
+    auto text = std::string{};
+    for (uint32_t i = 0; i < choice.size() && i < 9; i++) {
+        text += std::to_string(i + 1) + ". ";
+        text += choice[i];
+        text += "\n";
+    }
+    _characterBox->hide();
+    _speechBox->showText(text);
+    _choiceSize = choice.size();
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "booka.hpp"
+#include "interpreter.hpp"
 #include "repa.hpp"
 #include "sdl.hpp"
 #include "widget.hpp"
@@ -9,6 +10,7 @@
 #include <SDL_mixer.h>
 #include <SDL_ttf.h>
 
+#include <deque>
 #include <filesystem>
 #include <memory>
 #include <optional>
@@ -17,18 +19,37 @@
 
 class View {
 public:
-    View(booka::Booka& booka);
+    explicit View(std::unique_ptr<booka::Booka> booka);
 
     bool processInput();
     void present();
 
+    // Replace the story with one packed again, and continue from the action
+    // shown last, with the variables set so far. Textures are only created
+    // again for images that changed.
+    void reloadStory(std::unique_ptr<booka::Booka> booka);
+    // Replace the resources with ones packed again. They must have the names
+    // compiled into the game, in the same order.
+    void reloadResources(std::unique_ptr<repa::Repa> repa);
+
     void showTest();
 
 private:
     bool update();
+    bool show(const booka::Action& action);
+    void showChoice(const booka::Choice& choice);
+    void playMusic(std::optional<uint32_t> musicIndex);
+    bool rewind();
+    [[nodiscard]] sdl::Texture createTexture(
+        const booka::Booka& booka, uint32_t imageIndex);
 
-    booka::Booka& _booka;
-    booka::Actions::Iterator _actionIterator;
+    std::unique_ptr<booka::Booka> _booka;
+    booka::Interpreter _interpreter;
+    // Number of options of the choice shown, if waiting for one to be picked
+    size_t _choiceSize = 0;
+    // Interpreter state before each of the last steps, newest last
+    std::deque<booka::Snapshot> _history;
+    std::optional<uint32_t> _musicIndex;
     size_t _backgroundIndex = size_t(-1);
 
     sdl::Window _window;
@@ -36,11 +57,18 @@ private:
 
     std::vector<sdl::Texture> _textures;
 
-    repa::Repa _repa;
+    std::unique_ptr<repa::Repa> _repa;
+    // Fonts read from their data as they render, so it is kept for as long as
+    // they are
+    data::Blob _fontData;
     ttf::Font _font;
     SpeechBox* _characterBox = nullptr;
     SpeechBox* _speechBox = nullptr;
+    Button* _quitButton = nullptr;
     Widgets _widgets;
+    // Music decodes from its data while playing. A compressed blob may be
+    // evicted from the booka's cache meanwhile, so the data is held here.
+    data::Blob _musicData;
     std::unique_ptr<Mix_Music, void(*)(Mix_Music*)> _music {nullptr, Mix_FreeMusic};
 
     // This is a (very) poor man's event queue from UI elements. Temporary.
@@ -82,6 +82,13 @@ public:
             y >= _outerRect.y && y < _outerRect.y + _outerRect.h;
     }
 
+    // The text is rendered again with the new font on the next frame
+    void setFontData(std::span<const std::byte> fontData)
+    {
+        _fontData = fontData;
+        _textTexture = sdl::Texture{};
+    }
+
     void render(sdl::Renderer& renderer) override
     {
         renderer.fillRect(_outerRect, borderColor);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "data.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+namespace pixels {
+
+struct DecodedImage {
+    data::fb::Pixels info;
+    std::vector<std::byte> pixels;
+};
+
+// Decode an image file into rows of pixels in the format SDL's accelerated
+// renderers keep textures in, with no padding between rows.
+DecodedImage decode(const std::filesystem::path& path);
+
+struct DecodedImages {
+    std::vector<data::fb::Pixels> infos;
+    std::vector<std::filesystem::path> paths;
+};
+
+// Decode image files on one thread per hardware thread, writing pixels of each
+// to a file in directory, ready to be packed in place of the image. Files are
+// named after a hash of the image's contents, and images already decoded into
+// directory are not decoded again, so a directory kept between builds serves
+// as a cache.
+DecodedImages decodeToDirectory(
+    const std::vector<std::filesystem::path>& imagePaths,
+    const std::filesystem::path& directory);
+
+// Write decoded pixels as a PNG file, such as when extracting images packed
+// pre-decoded
+void writePng(
+    const data::fb::Pixels& info,
+    std::span<const std::byte> pixels,
+    const std::filesystem::path& path);
+
+} // namespace pixels
@@ -0,0 +1,160 @@
+#include "pixels.hpp"
+
+#include "error.hpp"
+#include "fs.hpp"
+#include "hash.hpp"
+#include "parallel.hpp"
+
+#include <SDL.h>
+#include <SDL_image.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+namespace pixels {
+
+namespace {
+
+// Textures in this format are uploaded by the renderer without conversion
+constexpr uint32_t textureFormat = SDL_PIXELFORMAT_ARGB8888;
+
+using SurfacePtr = std::unique_ptr<SDL_Surface, void(*)(SDL_Surface*)>;
+
+SurfacePtr checkSurface(SDL_Surface* surface, const fs::path& path)
+{
+    if (!surface) {
+        throw Error{} << "cannot decode " << path << ": " << SDL_GetError();
+    }
+    return {surface, SDL_FreeSurface};
+}
+
+std::string hex(uint64_t value)
+{
+    auto stream = std::ostringstream{};
+    stream << std::hex << std::setw(16) << std::setfill('0') << value;
+    return stream.str();
+}
+
+// Pixel layout of a decoded image, kept next to its pixels
+void writeInfo(const fs::path& path, const data::fb::Pixels& info)
+{
+    auto output = std::ofstream{};
+    output.exceptions(std::ios::badbit | std::ios::failbit);
+    output.open(path);
+    output << info.width() << " " << info.height() << " " << info.pitch() <<
+        " " << info.pixelFormat() << "\n";
+}
+
+std::optional<data::fb::Pixels> readInfo(const fs::path& path)
+{
+    auto input = std::ifstream{path};
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t pitch = 0;
+    uint32_t pixelFormat = 0;
+    if (!(input >> width >> height >> pitch >> pixelFormat)) {
+        return std::nullopt;
+    }
+    return data::fb::Pixels{width, height, pitch, pixelFormat};
+}
+
+} // namespace
+
+DecodedImage decode(const fs::path& path)
+{
+    const auto loaded = checkSurface(IMG_Load(path.string().c_str()), path);
+    const auto converted = checkSurface(
+        SDL_ConvertSurfaceFormat(loaded.get(), textureFormat, 0), path);
+
+    const auto width = static_cast<uint32_t>(converted->w);
+    const auto height = static_cast<uint32_t>(converted->h);
+    const uint32_t pitch = width * SDL_BYTESPERPIXEL(textureFormat);
+    auto image = DecodedImage{
+        .info = data::fb::Pixels{width, height, pitch, textureFormat},
+        .pixels = std::vector<std::byte>(size_t{pitch} * height),
+    };
+
+    const auto* source = static_cast<const std::byte*>(converted->pixels);
+    for (size_t row = 0; row < height; row++) {
+        std::copy_n(
+            source + row * static_cast<size_t>(converted->pitch),
+            pitch,
+            image.pixels.data() + row * pitch);
+    }
+    return image;
+}
+
+DecodedImages decodeToDirectory(
+    const std::vector<fs::path>& imagePaths,
+    const fs::path& directory)
+{
+    fs::create_directories(directory);
+    // Load decoders once, before they are used from several threads
+    IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
+
+    auto decoded = DecodedImages{
+        .infos = std::vector<data::fb::Pixels>(imagePaths.size()),
+        .paths = std::vector<fs::path>(imagePaths.size()),
+    };
+    parallelFor(imagePaths.size(), [&] (size_t i) {
+        auto& path = decoded.paths.at(i);
+        path = directory /
+            (hex(hashFile(imagePaths.at(i), textureFormat)) + ".pixels");
+        auto infoPath = path;
+        infoPath.replace_extension(".info");
+        if (auto info = readInfo(infoPath); info && fs::exists(path)) {
+            decoded.infos.at(i) = *info;
+            return;
+        }
+
+        // Written under names of their own, and renamed into place, as the
+        // same image may be listed twice, and the directory may be shared
+        const auto image = decode(imagePaths.at(i));
+        const auto suffix = ".tmp-" + std::to_string(i);
+        auto temporaryPath = path;
+        temporaryPath += suffix;
+        file::write(temporaryPath, image.pixels);
+        fs::rename(temporaryPath, path);
+        auto temporaryInfoPath = infoPath;
+        temporaryInfoPath += suffix;
+        writeInfo(temporaryInfoPath, image.info);
+        fs::rename(temporaryInfoPath, infoPath);
+        decoded.infos.at(i) = image.info;
+    });
+    return decoded;
+}
+
+void writePng(
+    const data::fb::Pixels& info,
+    std::span<const std::byte> pixels,
+    const fs::path& path)
+{
+    if (pixels.size() < size_t{info.pitch()} * info.height()) {
+        throw Error{} << "cannot write " << path << ": " << pixels.size() <<
+            " bytes are too few for " << info.height() << " rows of " <<
+            info.pitch() << " bytes";
+    }
+    // The surface only reads the pixels, despite taking them as mutable
+    const auto surface = SurfacePtr{
+        SDL_CreateRGBSurfaceWithFormatFrom(
+            const_cast<std::byte*>(pixels.data()),
+            static_cast<int>(info.width()),
+            static_cast<int>(info.height()),
+            SDL_BITSPERPIXEL(info.pixelFormat()),
+            static_cast<int>(info.pitch()),
+            info.pixelFormat()),
+        SDL_FreeSurface};
+    if (!surface || IMG_SavePNG(surface.get(), path.string().c_str()) != 0) {
+        throw Error{} << "cannot write " << path << ": " << SDL_GetError();
+    }
+}
+
+} // namespace pixels
@@ -2,15 +2,18 @@
 
 #include "repa_generated.h"
 
+#include "audio.hpp"
 #include "data.hpp"
 #include "memory_mapped_file.hpp"
 
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
-#include <map>
+#include <optional>
 #include <span>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 namespace repa {
@@ -18,39 +21,153 @@ namespace repa {
 struct Source {
     std::string name;
     std::filesystem::path path;
+    // Store the image decoded into pixels, ready to be uploaded to a texture
+    bool decodePixels = false;
+    // Transcode WAV audio to Ogg Vorbis, resampled to the game's audio rate
+    bool transcodeAudio = false;
 };
 
 struct Manifest {
     std::vector<Source> sources;
 };
 
+// Read a YAML manifest. Resource paths are relative to the manifest.
+Manifest loadManifest(const std::filesystem::path& yamlManifestPath);
+
+// Pack resources into the data file, and write a header enumerating them in
+// enum class R, with a ResourceTable<R> describing each. The header is only
+// rewritten if its contents change, so that code including it is not rebuilt
+// when the resources are packed again unchanged. With an empty header path,
+// such as when packing again while the game runs, no header is written.
 void pack(
     const Manifest& manifest,
     const std::filesystem::path& outputHeaderPath,
-    const std::filesystem::path& outputDataFilePath);
+    const std::filesystem::path& outputDataFilePath,
+    const data::BinaryDataPackOptions& options = {},
+    const audio::TranscodeOptions& audioOptions = {});
+// Pack resources listed in a YAML manifest. If depfilePath is not empty, also
+// write a depfile listing the manifest and the resource files.
 void packByYaml(
     const std::filesystem::path& yamlManifestPath,
     const std::filesystem::path& outputHeaderPath,
-    const std::filesystem::path& outputDataFilePath);
+    const std::filesystem::path& outputDataFilePath,
+    const data::BinaryDataPackOptions& options = {},
+    const audio::TranscodeOptions& audioOptions = {},
+    const std::filesystem::path& depfilePath = {});
 
 struct Resource {
     std::string_view name;
     std::span<const std::byte> content;
 };
 
+// What a resource is used as, guessed from its extension at pack time
+enum class Kind : uint8_t {
+    Other,
+    Font,
+    Texture,
+    Audio,
+};
+
+// Resource as described in the generated header. Size and hash are of the
+// content stored in the data file.
+struct ResourceInfo {
+    std::string_view name;
+    Kind kind = Kind::Other;
+    uint64_t size = 0;
+    uint64_t hash = 0;
+};
+
+// Specialized for enum class R in the generated header, with constexpr
+// entries (one ResourceInfo per resource, in enum order) and fingerprint
+template <class Id>
+struct ResourceTable;
+
+struct FontResource {
+    data::Blob data;
+};
+
+struct TextureResource {
+    data::Blob data;
+    // Pixel layout, if stored pre-decoded
+    std::optional<data::fb::Pixels> pixels;
+};
+
+struct AudioResource {
+    data::Blob data;
+};
+
 class Repa {
 public:
-    Repa(const std::filesystem::path& path);
+    Repa(const std::filesystem::path& path, const MapOptions& options = {});
+    // Resources already in memory, such as linked into the executable. The
+    // buffer must outlive the Repa, and be aligned like a mapped file.
+    explicit Repa(std::span<const std::byte> buffer);
+
+    [[nodiscard]] data::Blob operator()(size_t resourceIndex) const;
+    [[nodiscard]] data::Blob operator()(std::string_view resourceName) const;
+
+    // Pixel layout of a resource, if it is an image stored pre-decoded
+    [[nodiscard]] std::optional<data::fb::Pixels> pixels(
+        size_t resourceIndex) const;
+
+    // Resource by its id in the generated header, typed by its kind. The index
+    // is a compile-time constant.
+    template <auto id>
+    [[nodiscard]] auto get() const
+    {
+        constexpr auto index = static_cast<size_t>(id);
+        constexpr auto& entries = ResourceTable<decltype(id)>::entries;
+        static_assert(index < entries.size());
 
-    [[nodiscard]] std::span<const std::byte> operator()(size_t resourceIndex) const;
-    [[nodiscard]] std::span<const std::byte> operator()(
-        std::string_view resourceName) const;
+        auto data = (*this)(index);
+        if constexpr (entries[index].kind == Kind::Font) {
+            return FontResource{.data = std::move(data)};
+        } else if constexpr (entries[index].kind == Kind::Texture) {
+            return TextureResource{
+                .data = std::move(data), .pixels = pixels(index)};
+        } else if constexpr (entries[index].kind == Kind::Audio) {
+            return AudioResource{.data = std::move(data)};
+        } else {
+            return data;
+        }
+    }
+
+    [[nodiscard]] uint64_t fingerprint() const;
+
+    // The mapped file, for hints on resources about to be used, or done
+    // with. Null for resources already in memory.
+    [[nodiscard]] const MemoryMappedFile* file() const
+    {
+        return _file ? &*_file : nullptr;
+    }
+
+    // Throw unless the file was packed together with the header defining Id.
+    // Run once at startup, so that a stale header is not used to read the
+    // wrong resources.
+    template <class Id>
+    void check() const
+    {
+        checkFingerprint(
+            ResourceTable<Id>::fingerprint, ResourceTable<Id>::entries.size());
+    }
+
+    // Throw unless the file has the resources of the header defining Id, in
+    // the same order. Unlike check, allows their contents to differ, as they do
+    // when resources are packed again while the game is running.
+    template <class Id>
+    void checkNames() const
+    {
+        checkNames(ResourceTable<Id>::entries);
+    }
 
 private:
-    MemoryMappedFile _file;
+    void checkFingerprint(uint64_t fingerprint, size_t resourceCount) const;
+    void checkNames(std::span<const ResourceInfo> entries) const;
+
+    std::optional<MemoryMappedFile> _file;
+    std::span<const std::byte> _buffer;
     const fb::Repa* _repa = nullptr;
     data::NamedDataStorage _resources;
-    std::map<std::string, size_t> _indexByName;
 };
 
 } // namespace repa
@@ -1,11 +1,20 @@
 #include "repa.hpp"
 
+#include "error.hpp"
 #include "fs.hpp"
+#include "hash.hpp"
+#include "logging.hpp"
+#include "pixels.hpp"
 
 #include <yaml-cpp/yaml.h>
 
+#include <algorithm>
+#include <array>
+#include <cctype>
 #include <fstream>
+#include <iterator>
 #include <regex>
+#include <sstream>
 
 namespace fs = std::filesystem;
 
@@ -13,7 +22,142 @@ namespace repa {
 
 namespace {
 
-Manifest loadManifestFromYaml(const fs::path& yamlManifestPath)
+void writeIfChanged(const fs::path& path, const std::string& contents)
+{
+    if (fs::exists(path)) {
+        auto input = std::ifstream{path, std::ios::binary};
+        const auto existing = std::string{
+            std::istreambuf_iterator<char>{input},
+            std::istreambuf_iterator<char>{}};
+        if (existing == contents) {
+            return;
+        }
+    }
+
+    auto output = std::ofstream{};
+    output.exceptions(std::ios::badbit | std::ios::failbit);
+    output.open(path, std::ios::binary | std::ios::trunc);
+    output << contents;
+}
+
+Kind kindOf(const Source& source)
+{
+    if (source.decodePixels) {
+        return Kind::Texture;
+    }
+    if (source.transcodeAudio) {
+        return Kind::Audio;
+    }
+
+    auto extension = source.path.extension().string();
+    std::transform(
+        extension.begin(), extension.end(), extension.begin(),
+        [] (unsigned char c) { return std::tolower(c); });
+    if (extension == ".ttf" || extension == ".otf") {
+        return Kind::Font;
+    }
+    if (extension == ".png" || extension == ".jpg" || extension == ".jpeg" ||
+            extension == ".bmp") {
+        return Kind::Texture;
+    }
+    if (extension == ".wav" || extension == ".ogg" || extension == ".mp3" ||
+            extension == ".flac") {
+        return Kind::Audio;
+    }
+    return Kind::Other;
+}
+
+std::string_view kindName(Kind kind)
+{
+    switch (kind) {
+        case Kind::Other: return "Other";
+        case Kind::Font: return "Font";
+        case Kind::Texture: return "Texture";
+        case Kind::Audio: return "Audio";
+    }
+    return "Other";
+}
+
+uint64_t fingerprint(const std::vector<ResourceInfo>& resources)
+{
+    auto hasher = Hasher{};
+    for (const auto& resource : resources) {
+        const auto fields = std::array<uint64_t, 4>{
+            resource.name.size(),
+            static_cast<uint64_t>(resource.kind),
+            resource.size,
+            resource.hash,
+        };
+        hasher.update(std::as_bytes(std::span{resource.name}));
+        hasher.update(std::as_bytes(std::span{fields}));
+    }
+    return hasher.digest();
+}
+
+// Resource name as a C++ string literal
+std::string quoted(std::string_view name)
+{
+    auto literal = std::string{"\""};
+    for (const char c : name) {
+        if (c == '"' || c == '\\') {
+            literal += '\\';
+        }
+        literal += c;
+    }
+    return literal + "\"";
+}
+
+std::string header(
+    const Manifest& manifest,
+    const std::vector<ResourceInfo>& resources,
+    uint64_t fingerprint)
+{
+    auto header = std::ostringstream{};
+    header << R"(#pragma once
+
+#include <repa.hpp>
+
+#include <array>
+#include <cstdint>
+
+enum class R {
+)";
+
+    for (const auto& source : manifest.sources) {
+        std::string enumName =
+            std::regex_replace(source.name, std::regex{"[^a-zA-Z0-9]+"}, "_");
+        std::transform(
+            enumName.begin(), enumName.end(), enumName.begin(),
+            [] (unsigned char c) { return std::toupper(c); });
+        header << "    " << enumName << ",\n";
+    }
+
+    header << R"(};
+
+namespace repa {
+
+template <>
+struct ResourceTable<R> {
+)";
+    header << "    static constexpr auto entries = std::array<ResourceInfo, " <<
+        resources.size() << ">{{\n";
+    for (const auto& resource : resources) {
+        header << "        {" << quoted(resource.name) << ", Kind::" <<
+            kindName(resource.kind) << ", " << resource.size << "ull, 0x" <<
+            std::hex << resource.hash << std::dec << "ull},\n";
+    }
+    header << "    }};\n" <<
+        "    static constexpr uint64_t fingerprint = 0x" << std::hex <<
+        fingerprint << std::dec << "ull;\n" << R"(};
+
+} // namespace repa
+)";
+    return header.str();
+}
+
+} // namespace
+
+Manifest loadManifest(const fs::path& yamlManifestPath)
 {
     auto manifest = Manifest{};
 
@@ -23,86 +167,217 @@ Manifest loadManifestFromYaml(const fs::path& yamlManifestPath)
             .name = yamlResource["name"].as<std::string>(),
             .path = yamlManifestPath.parent_path() /
                 yamlResource["path"].as<std::string>(),
+            .decodePixels = yamlResource["pixels"].as<bool>(false),
+            .transcodeAudio = yamlResource["audio"].as<bool>(false),
         });
     }
 
     return manifest;
 }
 
-} // namespace
-
 void packByYaml(
     const fs::path& yamlManifestPath,
     const fs::path& outputHeaderPath,
-    const fs::path& outputDataFilePath)
+    const fs::path& outputDataFilePath,
+    const data::BinaryDataPackOptions& options,
+    const audio::TranscodeOptions& audioOptions,
+    const fs::path& depfilePath)
 {
-    pack(
-        loadManifestFromYaml(yamlManifestPath),
-        outputHeaderPath,
-        outputDataFilePath);
+    const auto manifest = loadManifest(yamlManifestPath);
+    pack(manifest, outputHeaderPath, outputDataFilePath, options, audioOptions);
+
+    if (!depfilePath.empty()) {
+        auto dependencies = std::vector<fs::path>{yamlManifestPath};
+        for (const auto& source : manifest.sources) {
+            dependencies.push_back(source.path);
+        }
+        file::writeDepfile(depfilePath, outputDataFilePath, dependencies);
+    }
 }
 
 void pack(
     const Manifest& manifest,
     const fs::path& outputHeaderPath,
-    const fs::path& outputDataFilePath)
+    const fs::path& outputDataFilePath,
+    const data::BinaryDataPackOptions& options,
+    const audio::TranscodeOptions& audioOptions)
 {
     std::vector<std::string> resourceNames;
-    std::vector<std::vector<std::byte>> resourceData;
+    std::vector<std::filesystem::path> resourcePaths;
+    for (const auto& source : manifest.sources) {
+        resourceNames.push_back(source.name);
+        resourcePaths.push_back(source.path);
+    }
 
-    auto header = std::ofstream{outputHeaderPath};
-    header.exceptions(std::ios::badbit | std::ios::failbit);
-    header << R"(#pragma once
+    // Decoded images and transcoded audio are kept in the cache directory, so
+    // that unchanged files are not decoded or transcoded again by the next
+    // build. Without a cache, they go to temporary directories next to the
+    // output.
+    const bool cached = !options.cacheDirectory.empty();
+    auto transformDirectory = [&] (const std::string& name) {
+        if (cached) {
+            return options.cacheDirectory / name;
+        }
+        auto directory = outputDataFilePath;
+        directory += "." + name;
+        return directory;
+    };
 
-enum class R {
-)";
+    auto resourcePixels = std::vector<data::fb::Pixels>(resourcePaths.size());
+    auto decodedIndices = std::vector<size_t>{};
+    auto imagePaths = std::vector<fs::path>{};
+    for (size_t i = 0; i < manifest.sources.size(); i++) {
+        if (manifest.sources.at(i).decodePixels) {
+            decodedIndices.push_back(i);
+            imagePaths.push_back(resourcePaths.at(i));
+        }
+    }
+    const auto pixelsDirectory = transformDirectory("pixels");
+    if (!decodedIndices.empty()) {
+        const auto decoded =
+            pixels::decodeToDirectory(imagePaths, pixelsDirectory);
+        for (size_t k = 0; k < decodedIndices.size(); k++) {
+            resourcePaths.at(decodedIndices.at(k)) = decoded.paths.at(k);
+            resourcePixels.at(decodedIndices.at(k)) = decoded.infos.at(k);
+        }
+    }
 
-    for (const auto& source : manifest.sources) {
-        std::string enumName =
-            std::regex_replace(source.name, std::regex{"[^a-zA-Z0-9]+"}, "_");
-        std::transform(
-            enumName.begin(), enumName.end(), enumName.begin(),
-            [] (unsigned char c) { return std::toupper(c); });
-        header << "    " << enumName << ",\n";
+    auto transcodedIndices = std::vector<size_t>{};
+    auto audioPaths = std::vector<fs::path>{};
+    for (size_t i = 0; i < manifest.sources.size(); i++) {
+        if (manifest.sources.at(i).transcodeAudio) {
+            transcodedIndices.push_back(i);
+            audioPaths.push_back(resourcePaths.at(i));
+        }
+    }
+    if (!transcodedIndices.empty() && !audio::canTranscode()) {
+        LOG(Warning) << "built without an audio encoder, packing " <<
+            transcodedIndices.size() << " audio resources as they are";
+        transcodedIndices.clear();
+    }
+    const auto audioDirectory = transformDirectory("audio");
+    if (!transcodedIndices.empty()) {
+        const auto transcoded = audio::transcodeToDirectory(
+            audioPaths, audioDirectory, audioOptions);
+        for (size_t k = 0; k < transcodedIndices.size(); k++) {
+            resourcePaths.at(transcodedIndices.at(k)) = transcoded.at(k);
+        }
+    }
 
-        resourceNames.push_back(source.name);
-        resourceData.push_back(file::read(source.path));
+    // Described as stored, after decoding and transcoding
+    auto resources = std::vector<ResourceInfo>{};
+    for (size_t i = 0; i < manifest.sources.size(); i++) {
+        const auto& path = resourcePaths.at(i);
+        resources.push_back(ResourceInfo{
+            .name = resourceNames.at(i),
+            .kind = kindOf(manifest.sources.at(i)),
+            .size = fs::file_size(path),
+            .hash = hashFile(path),
+        });
     }
+    const auto resourcesFingerprint = fingerprint(resources);
 
-    header << "};";
+    auto report = data::packStreaming(
+        outputDataFilePath,
+        {resourcePaths},
+        [&] (flatbuffers::FlatBufferBuilder& builder,
+                const std::vector<flatbuffers::Offset<data::fb::BinaryData>>& blobTables) {
+            return fb::CreateRepa(
+                builder,
+                data::pack(builder, resourceNames, {.nameIndex = true}),
+                blobTables.at(0),
+                decodedIndices.empty() ?
+                    0 : builder.CreateVectorOfStructs(resourcePixels),
+                resourcesFingerprint).Union();
+        },
+        options);
+    LOG(Info) << "packed " << outputDataFilePath << ": " << report;
 
-    auto builder = flatbuffers::FlatBufferBuilder{};
-    auto repa = fb::CreateRepa(
-        builder,
-        data::pack(builder, resourceNames),
-        data::pack(builder, resourceData));
-    builder.Finish(repa);
+    if (!outputHeaderPath.empty()) {
+        writeIfChanged(
+            outputHeaderPath, header(manifest, resources, resourcesFingerprint));
+    }
 
-    file::write(
-        outputDataFilePath,
-        reinterpret_cast<const std::byte*>(builder.GetBufferPointer()),
-        builder.GetSize());
+    if (!cached && !decodedIndices.empty()) {
+        fs::remove_all(pixelsDirectory);
+    }
+    if (!cached && !transcodedIndices.empty()) {
+        fs::remove_all(audioDirectory);
+    }
+}
+
+Repa::Repa(const std::filesystem::path& path, const MapOptions& options)
+    : _file(std::in_place, path, options)
+    , _buffer(_file->span())
+    , _repa(fb::GetRepa(_buffer.data()))
+    , _resources(_repa->resourceNames(), _repa->resourceData(), _buffer)
+{ }
+
+Repa::Repa(std::span<const std::byte> buffer)
+    : _buffer(buffer)
+    , _repa(fb::GetRepa(_buffer.data()))
+    , _resources(_repa->resourceNames(), _repa->resourceData(), _buffer)
+{ }
+
+data::Blob Repa::operator()(size_t resourceIndex) const
+{
+    return _resources[(uint32_t)resourceIndex].data;
 }
 
-Repa::Repa(const std::filesystem::path& path)
-    : _file(path)
-    , _repa(fb::GetRepa(_file.span().data()))
-    , _resources(_repa->resourceNames(), _repa->resourceData())
+data::Blob Repa::operator()(std::string_view resourceName) const
 {
-    for (size_t i = 0; i < _resources.size(); i++) {
-        _indexByName[std::string{_resources[(uint32_t)i].name}] = i;
+    auto index = _resources.find(resourceName);
+    if (!index) {
+        throw Error{} << "no such resource: " << resourceName;
     }
+    return (*this)(*index);
 }
 
-std::span<const std::byte> Repa::operator()(size_t resourceIndex) const
+uint64_t Repa::fingerprint() const
 {
-    return _resources[(uint32_t)resourceIndex].data;
+    return _repa->fingerprint();
+}
+
+void Repa::checkFingerprint(uint64_t fingerprint, size_t resourceCount) const
+{
+    if (fingerprint != _repa->fingerprint() ||
+            resourceCount != _resources.size()) {
+        throw Error{} << "resource file does not match resources.hpp: it has " <<
+            _resources.size() << " resources and fingerprint " << std::hex <<
+            _repa->fingerprint() << ", the header " << std::dec <<
+            resourceCount << " and " << std::hex << fingerprint <<
+            "; rebuild to repack resources";
+    }
+}
+
+void Repa::checkNames(std::span<const ResourceInfo> entries) const
+{
+    if (entries.size() != _resources.size()) {
+        throw Error{} << "resource file has " << _resources.size() <<
+            " resources, resources.hpp " << entries.size() <<
+            "; rebuild to regenerate the header";
+    }
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        const auto name = _resources[i].name;
+        if (name != entries[i].name) {
+            throw Error{} << "resource " << i << " is '" << name <<
+                "' in the resource file, '" << entries[i].name <<
+                "' in resources.hpp; rebuild to regenerate the header";
+        }
+    }
 }
 
-std::span<const std::byte> Repa::operator()(
-    std::string_view resourceName) const
+std::optional<data::fb::Pixels> Repa::pixels(size_t resourceIndex) const
 {
-    return (*this)(_indexByName.at(std::string{resourceName}));
+    const auto* resourcePixels = _repa->resourcePixels();
+    if (!resourcePixels) {
+        return std::nullopt;
+    }
+    const auto* pixels = resourcePixels->Get((uint32_t)resourceIndex);
+    if (pixels->pixelFormat() == 0) {
+        return std::nullopt;
+    }
+    return *pixels;
 }
 
 } // namespace repa
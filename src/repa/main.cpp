@@ -21,8 +21,33 @@ int main(int argc, char* argv[])
         .keys("--output-data-file")
         .markRequired()
         .help("path to output data file");
+    auto audioRate = arg::option<int>()
+        .keys("--audio-rate")
+        .defaultValue(48000)
+        .help("sample rate to resample audio resources to, matching the "
+            "game's audio frequency");
+    auto depfilePath = arg::option<fs::path>()
+        .keys("--depfile")
+        .defaultValue(fs::path{})
+        .help("path to a Makefile-style depfile to write, listing the manifest "
+            "and resource files");
+    auto cacheDirectory = arg::option<fs::path>()
+        .keys("--cache-dir")
+        .defaultValue(fs::path{})
+        .help("reuse compressed resources and unchanged output from this "
+            "directory");
     arg::helpKeys("-h", "--help");
     arg::parse(argc, argv);
 
-    repa::packByYaml(manifestPath, outputHeaderPath, outputDataFilePath);
+    auto options = data::BinaryDataPackOptions{};
+    options.cacheDirectory = cacheDirectory;
+    auto audioOptions = audio::TranscodeOptions{};
+    audioOptions.sampleRate = audioRate;
+    repa::packByYaml(
+        manifestPath,
+        outputHeaderPath,
+        outputDataFilePath,
+        options,
+        audioOptions,
+        depfilePath);
 }
@@ -0,0 +1,235 @@
+#include "media.hpp"
+
+#include "arg.hpp"
+#include "error.hpp"
+#include "logging.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::vector<std::string> syllables {
+    "ба", "ва", "га", "да", "ка", "ла", "ма", "на", "ра", "са", "та",
+    "ни", "ри", "ли", "ся", "ша", "мо", "ко", "ду", "лю",
+};
+
+const std::vector<std::string> words {
+    "чай", "варенье", "стол", "гость", "чашка", "сахар", "пирог", "вечер",
+    "добрый", "сладкий", "горячий", "новый", "старый", "вкусный",
+    "пришёл", "сел", "налил", "сказал", "подумал", "улыбнулся",
+    "и", "а", "но", "тоже", "очень", "совсем", "сегодня", "здесь", "вот",
+};
+
+struct StoryOptions {
+    uint64_t seed = 0;
+    size_t phraseCount = 0;
+    size_t characterCount = 0;
+    size_t imageCount = 0;
+    size_t musicCount = 0;
+    uint32_t imageWidth = 0;
+    uint32_t imageHeight = 0;
+    uint32_t sampleRate = 0;
+    uint32_t musicSeconds = 0;
+};
+
+std::string capitalized(const std::string& word)
+{
+    static const std::string lower = "бвгдклмнрст";
+    static const std::string upper = "БВГДКЛМНРСТ";
+    // Every character in these strings takes two bytes in UTF-8
+    auto position = lower.find(word.substr(0, 2));
+    if (position == std::string::npos || position % 2 != 0) {
+        return word;
+    }
+    return upper.substr(position, 2) + word.substr(2);
+}
+
+std::vector<std::string> generateCharacterNames(
+    size_t count, std::mt19937_64& random)
+{
+    auto names = std::vector<std::string>{};
+    auto used = std::set<std::string>{};
+    while (names.size() < count) {
+        auto name = std::string{};
+        for (size_t i = 0, n = 2 + random() % 2; i < n; i++) {
+            name += syllables.at(random() % syllables.size());
+        }
+        name = capitalized(name);
+        if (used.contains(name)) {
+            name += " " + std::to_string(names.size());
+        }
+        used.insert(name);
+        names.push_back(std::move(name));
+    }
+    return names;
+}
+
+std::string generatePhrase(std::mt19937_64& random)
+{
+    auto phrase = std::string{};
+    for (size_t i = 0, n = 3 + random() % 20; i < n; i++) {
+        if (i > 0) {
+            phrase += " ";
+        }
+        phrase += words.at(random() % words.size());
+    }
+    return phrase + ".";
+}
+
+// Writes script.txt, images/ and music/ in the format booka encode reads
+void generate(const fs::path& outputDirectoryPath, const StoryOptions& options)
+{
+    if (options.phraseCount > 0 && options.characterCount == 0) {
+        throw Error{} << "a story with phrases needs at least one character";
+    }
+
+    auto random = std::mt19937_64{options.seed};
+
+    fs::create_directories(outputDirectoryPath / "images");
+    fs::create_directories(outputDirectoryPath / "music");
+
+    auto script = std::ofstream{outputDirectoryPath / "script.txt"};
+    script.exceptions(std::ios::badbit | std::ios::failbit);
+
+    uint64_t assetBytes = 0;
+    auto imageNames = std::vector<std::string>{};
+    for (size_t i = 0; i < options.imageCount; i++) {
+        auto relativePath = fs::path{"images"} / (std::to_string(i) + ".png");
+        auto path = outputDirectoryPath / relativePath;
+        writePng(path, options.imageWidth, options.imageHeight, random);
+        assetBytes += fs::file_size(path);
+
+        imageNames.push_back("фон " + std::to_string(i));
+        script << "[фон \"" << imageNames.back() << "\" " <<
+            relativePath.generic_string() << "]\n";
+    }
+    auto musicNames = std::vector<std::string>{};
+    for (size_t i = 0; i < options.musicCount; i++) {
+        auto relativePath = fs::path{"music"} / (std::to_string(i) + ".wav");
+        auto path = outputDirectoryPath / relativePath;
+        writeWav(path, options.sampleRate, options.musicSeconds, random);
+        assetBytes += fs::file_size(path);
+
+        musicNames.push_back("мелодия " + std::to_string(i));
+        script << "[музыка \"" << musicNames.back() << "\" " <<
+            relativePath.generic_string() << "]\n";
+    }
+    script << "\n";
+
+    const auto characterNames =
+        generateCharacterNames(options.characterCount, random);
+
+    // Backgrounds change every few phrases, and music every few hundred.
+    // Characters usually say a few phrases in a row, and some phrases are
+    // narration, separated by empty lines.
+    size_t actionCount = 0;
+    for (size_t phrase = 0; phrase < options.phraseCount; ) {
+        if (!musicNames.empty() && random() % 200 == 0) {
+            script << "(музыка: " <<
+                musicNames.at(random() % musicNames.size()) << ")\n";
+            actionCount++;
+        }
+        if (!imageNames.empty() && random() % 8 == 0) {
+            script << "(фон: " <<
+                imageNames.at(random() % imageNames.size()) << ")\n";
+            actionCount++;
+        }
+
+        if (random() % 10 == 0) {
+            script << "\n" << generatePhrase(random) << "\n\n";
+            phrase++;
+        } else {
+            script << characterNames.at(random() % characterNames.size()) <<
+                ": " << generatePhrase(random) << "\n";
+            for (size_t i = 0, n = random() % 3;
+                    i < n && phrase + 1 < options.phraseCount; i++) {
+                script << generatePhrase(random) << "\n";
+                phrase++;
+                actionCount++;
+            }
+            phrase++;
+        }
+        actionCount++;
+    }
+
+    script.close();
+    LOG(Info) << "generated " << outputDirectoryPath << ": " <<
+        actionCount << " actions, " <<
+        Size{fs::file_size(outputDirectoryPath / "script.txt")} <<
+        " of script, " << options.imageCount << " images and " <<
+        options.musicCount << " music tracks in " << Size{assetBytes};
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) try
+{
+    auto parser = arg::Parser{};
+    auto output = parser.option<fs::path>()
+        .keys("--output")
+        .markRequired()
+        .help("directory to write script.txt, images and music to");
+    auto seed = parser.option<uint64_t>()
+        .keys("--seed")
+        .defaultValue(0)
+        .help("random seed; the same seed and options produce the same story");
+    auto phrases = parser.option<size_t>()
+        .keys("--phrases")
+        .defaultValue(1000)
+        .help("number of phrases");
+    auto characters = parser.option<size_t>()
+        .keys("--characters")
+        .defaultValue(8)
+        .help("number of characters");
+    auto images = parser.option<size_t>()
+        .keys("--images")
+        .defaultValue(16)
+        .help("number of background images");
+    auto music = parser.option<size_t>()
+        .keys("--music")
+        .defaultValue(2)
+        .help("number of music tracks");
+    auto imageWidth = parser.option<uint32_t>()
+        .keys("--image-width")
+        .defaultValue(640)
+        .help("width of every image, in pixels");
+    auto imageHeight = parser.option<uint32_t>()
+        .keys("--image-height")
+        .defaultValue(360)
+        .help("height of every image, in pixels");
+    auto sampleRate = parser.option<uint32_t>()
+        .keys("--sample-rate")
+        .defaultValue(44100)
+        .help("sample rate of every music track");
+    auto musicSeconds = parser.option<uint32_t>()
+        .keys("--music-seconds")
+        .defaultValue(10)
+        .help("length of every music track, in seconds");
+    parser.helpKeys("-h", "--help");
+    parser.parse(argc, argv);
+
+    generate(output, {
+        .seed = seed,
+        .phraseCount = phrases,
+        .characterCount = characters,
+        .imageCount = images,
+        .musicCount = music,
+        .imageWidth = imageWidth,
+        .imageHeight = imageHeight,
+        .sampleRate = sampleRate,
+        .musicSeconds = musicSeconds,
+    });
+} catch (const std::exception& e) {
+    LOG(Error) << e.what();
+    return EXIT_FAILURE;
+}
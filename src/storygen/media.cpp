@@ -0,0 +1,231 @@
+#include "media.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <numbers>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+class Writer {
+public:
+    Writer(const fs::path& path)
+        : _output(path, std::ios::binary)
+    {
+        _output.exceptions(std::ios::badbit | std::ios::failbit);
+    }
+
+    void bytes(std::span<const uint8_t> data)
+    {
+        _output.write(
+            reinterpret_cast<const char*>(data.data()),
+            static_cast<std::streamsize>(data.size()));
+    }
+
+    void text(std::string_view s)
+    {
+        _output.write(s.data(), static_cast<std::streamsize>(s.size()));
+    }
+
+    void le16(uint16_t x)
+    {
+        bytes(std::array{uint8_t(x), uint8_t(x >> 8)});
+    }
+
+    void le32(uint32_t x)
+    {
+        bytes(std::array{
+            uint8_t(x), uint8_t(x >> 8), uint8_t(x >> 16), uint8_t(x >> 24)});
+    }
+
+    void be32(uint32_t x)
+    {
+        bytes(std::array{
+            uint8_t(x >> 24), uint8_t(x >> 16), uint8_t(x >> 8), uint8_t(x)});
+    }
+
+private:
+    std::ofstream _output;
+};
+
+// CRC-32 as used by PNG (and zlib), which is not the CRC-32C in base
+uint32_t crc32(std::span<const uint8_t> data, uint32_t crc = 0)
+{
+    static const auto table = [] {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return table;
+    }();
+
+    crc = ~crc;
+    for (uint8_t byte : data) {
+        crc = table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+uint32_t adler32(std::span<const uint8_t> data)
+{
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (uint8_t byte : data) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+void writeChunk(
+    Writer& writer, std::string_view type, std::span<const uint8_t> data)
+{
+    writer.be32(static_cast<uint32_t>(data.size()));
+    writer.text(type);
+    writer.bytes(data);
+
+    auto crc = crc32(
+        {reinterpret_cast<const uint8_t*>(type.data()), type.size()});
+    writer.be32(crc32(data, crc));
+}
+
+// zlib stream of stored deflate blocks
+std::vector<uint8_t> zlibStored(std::span<const uint8_t> data)
+{
+    constexpr size_t maxBlockSize = 65535;
+
+    auto stream = std::vector<uint8_t>{0x78, 0x01};
+    size_t offset = 0;
+    do {
+        auto size = std::min(maxBlockSize, data.size() - offset);
+        bool last = offset + size == data.size();
+        stream.push_back(last ? 1 : 0);
+        stream.push_back(uint8_t(size));
+        stream.push_back(uint8_t(size >> 8));
+        stream.push_back(uint8_t(~size));
+        stream.push_back(uint8_t(~size >> 8));
+        stream.insert(
+            stream.end(),
+            data.begin() + static_cast<ptrdiff_t>(offset),
+            data.begin() + static_cast<ptrdiff_t>(offset + size));
+        offset += size;
+    } while (offset < data.size());
+
+    auto adler = adler32(data);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        stream.push_back(uint8_t(adler >> shift));
+    }
+    return stream;
+}
+
+} // namespace
+
+void writePng(
+    const fs::path& path,
+    uint32_t width,
+    uint32_t height,
+    std::mt19937_64& random)
+{
+    // A diagonal gradient between two random colors, with some noise on top
+    const auto from = random();
+    const auto to = random();
+    const auto channel = [] (uint64_t color, int i) {
+        return static_cast<int>((color >> (8 * i)) & 0xff);
+    };
+
+    auto pixels = std::vector<uint8_t>{};
+    pixels.reserve(size_t{height} * (1 + size_t{width} * 3));
+    for (uint32_t y = 0; y < height; y++) {
+        pixels.push_back(0); // filter type: none
+        for (uint32_t x = 0; x < width; x++) {
+            auto position = (x + y) * 256 / (width + height);
+            for (int i = 0; i < 3; i++) {
+                auto value = channel(from, i) +
+                    (channel(to, i) - channel(from, i)) * (int)position / 256 +
+                    (int)(random() % 16) - 8;
+                pixels.push_back(uint8_t(std::clamp(value, 0, 255)));
+            }
+        }
+    }
+
+    auto header = std::array<uint8_t, 13>{
+        uint8_t(width >> 24), uint8_t(width >> 16),
+        uint8_t(width >> 8), uint8_t(width),
+        uint8_t(height >> 24), uint8_t(height >> 16),
+        uint8_t(height >> 8), uint8_t(height),
+        8, // bit depth
+        2, // color type: RGB
+        0, // compression method
+        0, // filter method
+        0, // interlace method
+    };
+
+    auto writer = Writer{path};
+    writer.bytes(std::array<uint8_t, 8>{
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'});
+    writeChunk(writer, "IHDR", header);
+    writeChunk(writer, "IDAT", zlibStored(pixels));
+    writeChunk(writer, "IEND", {});
+}
+
+void writeWav(
+    const fs::path& path,
+    uint32_t sampleRate,
+    uint32_t seconds,
+    std::mt19937_64& random)
+{
+    constexpr uint16_t channels = 2;
+    constexpr uint16_t bytesPerSample = 2;
+    const uint32_t frameCount = sampleRate * seconds;
+    const uint32_t dataSize = frameCount * channels * bytesPerSample;
+
+    auto writer = Writer{path};
+    writer.text("RIFF");
+    writer.le32(36 + dataSize);
+    writer.text("WAVE");
+    writer.text("fmt ");
+    writer.le32(16);
+    writer.le16(1); // PCM
+    writer.le16(channels);
+    writer.le32(sampleRate);
+    writer.le32(sampleRate * channels * bytesPerSample);
+    writer.le16(channels * bytesPerSample);
+    writer.le16(8 * bytesPerSample);
+    writer.text("data");
+    writer.le32(dataSize);
+
+    // A few seconds long tones of random pitch, over quiet noise
+    auto samples = std::vector<uint8_t>{};
+    samples.reserve(sampleRate * channels * bytesPerSample);
+    double frequency = 0;
+    double phase = 0;
+    for (uint32_t frame = 0; frame < frameCount; frame++) {
+        if (frame % (2 * sampleRate) == 0) {
+            frequency = 220.0 * std::pow(2.0, (double)(random() % 24) / 12);
+        }
+        phase += 2 * std::numbers::pi * frequency / sampleRate;
+        auto tone = 8000 * std::sin(phase);
+        for (uint16_t channel = 0; channel < channels; channel++) {
+            auto value = static_cast<int16_t>(
+                tone + (double)(random() % 512) - 256);
+            samples.push_back(uint8_t(value));
+            samples.push_back(uint8_t(static_cast<uint16_t>(value) >> 8));
+        }
+
+        if (samples.size() == samples.capacity()) {
+            writer.bytes(samples);
+            samples.clear();
+        }
+    }
+    writer.bytes(samples);
+}
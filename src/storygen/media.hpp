@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <random>
+
+// Minimal valid media files for generated stories. Contents are noise, shaped
+// enough to be seekable by eye and ear, and to compress about as badly as real
+// assets do.
+
+// RGB PNG, with deflate-stored (uncompressed) image data.
+void writePng(
+    const std::filesystem::path& path,
+    uint32_t width,
+    uint32_t height,
+    std::mt19937_64& random);
+
+// 16-bit stereo PCM WAV.
+void writeWav(
+    const std::filesystem::path& path,
+    uint32_t sampleRate,
+    uint32_t seconds,
+    std::mt19937_64& random);
@@ -1,47 +1,92 @@
+#include "interpreter.hpp"
 #include "overloaded.hpp"
-#include "story.hpp"
 
+#include <arg.hpp>
+
+#include <cstdint>
 #include <cstdlib>
 #include <exception>
+#include <filesystem>
 #include <iomanip>
 #include <iostream>
-#include <type_traits>
+#include <string>
 #include <variant>
 
-int main() try
+namespace fs = std::filesystem;
+
+// Play a booka in the terminal: phrases one per line, choices as numbered
+// options. Images and music are named, not shown.
+int main(int argc, char* argv[]) try
 {
-    auto story = Story{};
-    story.initializeTestStory();
+    auto parser = arg::Parser{};
+    auto storyPath = parser.option<fs::path>()
+        .keys("--story")
+        .markRequired()
+        .help("path to story booka file");
+    auto from = parser.option<uint32_t>()
+        .keys("--from")
+        .defaultValue(0)
+        .help("action to start from, in a story without choices");
+    parser.helpKeys("-h", "--help");
+    parser.parse(argc, argv);
+
+    const auto booka = booka::Booka{storyPath, {.verify = true}};
+    auto interpreter = booka::Interpreter{booka};
+    if (from > 0) {
+        interpreter.seek(from);
+        const auto& state = interpreter.state();
+        if (state.imageIndex) {
+            std::cout << "image: " <<
+                booka.images()[*state.imageIndex].name << "\n";
+        }
+        if (state.musicIndex) {
+            std::cout << "music: " <<
+                booka.music()[*state.musicIndex].name << "\n";
+        }
+    }
 
     bool done = false;
     while (!done) {
         std::visit(Overloaded{
-            [&story](const ShowBackground& bg) {
-                std::cout << "change background: " << bg.id << "\n";
-                story.next();
-            },
-            [&](const Text& text) {
-                std::cout << text.character << ": " << text.text;
-                std::cin.get();
-                story.next();
+            [&](const booka::Action& action) {
+                std::visit(Overloaded{
+                    [&](const booka::ShowImageAction& image) {
+                        std::cout << "image: " <<
+                            booka.images()[image.imageIndex].name << "\n";
+                    },
+                    [&](const booka::PlayMusicAction& music) {
+                        std::cout << "music: " <<
+                            booka.music()[music.musicIndex].name << "\n";
+                    },
+                    [](const booka::ShowTextAction& text) {
+                        if (!text.character.empty()) {
+                            std::cout << text.character << ": ";
+                        }
+                        std::cout << text.text;
+                        std::cin.get();
+                    },
+                    [](const booka::UnknownAction&) {},
+                }, action);
             },
-            [&story](const Choice& choice) {
-                for (size_t i = 0; i < choice.selections.size(); i++) {
-                    std::cout << std::setw(2) << i << ": " <<
-                        choice.selections.at(i).text << "\n";
+            [&](const booka::Choice& choice) {
+                for (uint32_t i = 0; i < choice.size(); i++) {
+                    std::cout << std::setw(2) << i << ": " << choice[i] << "\n";
                 }
 
-                int selection = 0;
+                uint32_t selection = 0;
                 std::cin >> selection;
                 std::string s;
                 std::getline(std::cin, s);
-                story.select(selection);
+                if (!std::cin) {
+                    done = true;
+                } else if (selection < choice.size()) {
+                    interpreter.select(selection);
+                }
             },
-            [&done](const Finish&) {
+            [&done](const booka::Finish&) {
                 done = true;
-                return;
             },
-        }, story.action());
+        }, interpreter.step());
     }
 } catch (const std::exception& e) {
     std::cerr << e.what() << "\n";